@@ -0,0 +1,386 @@
+// bench.c - synthetic workloads for the sound_seg library
+//
+// built by `make bench` with optimisations and no sanitizers. every workload prints one JSON object
+// per line so runs from different commits can be diffed / compared by a script:
+//   {"bench":..., "ops":..., "ns_per_op":..., "samples_per_sec":..., "allocs":..., "alloc_bytes":...}
+// allocations are counted by wrapping malloc/calloc/realloc at link time (see BENCH_LDFLAGS)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sound_seg.h"
+
+#define SAMPLE_RATE 8000
+#define LONG_TRACK_SECONDS (2 * 60 * 60) // a two hour track
+
+// allocation counters, bumped by the --wrap'd allocators below. atomic because wav_load_batch
+// allocates from its worker threads
+static atomic_size_t alloc_count = 0;
+static atomic_size_t alloc_bytes = 0;
+
+static void count_alloc(size_t bytes) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, bytes, memory_order_relaxed);
+}
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    count_alloc(size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    count_alloc(n * size);
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    count_alloc(size);
+    return __real_realloc(ptr, size);
+}
+
+typedef struct {
+    struct timespec start;
+    size_t allocs;
+    size_t bytes;
+} BenchMark;
+
+static void bench_begin(BenchMark* mark) {
+    mark->allocs = atomic_load(&alloc_count);
+    mark->bytes = atomic_load(&alloc_bytes);
+    clock_gettime(CLOCK_MONOTONIC, &mark->start);
+}
+
+// samples = how many samples the workload pushed through, 0 if that doesn't mean anything for it
+static void bench_end(const BenchMark* mark, const char* name, size_t ops, size_t samples) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (double)(end.tv_sec - mark->start.tv_sec) * 1e9 + (double)(end.tv_nsec - mark->start.tv_nsec);
+    double ns_per_op = ops > 0 ? ns / (double)ops : 0.0;
+    double samples_per_sec = ns > 0 ? (double)samples / (ns / 1e9) : 0.0;
+
+    printf("{\"bench\":\"%s\",\"ops\":%zu,\"ns_per_op\":%.1f,\"samples_per_sec\":%.0f,\"allocs\":%zu,\"alloc_bytes\":%zu}\n",
+           name, ops, ns_per_op, samples_per_sec, atomic_load(&alloc_count) - mark->allocs,
+           atomic_load(&alloc_bytes) - mark->bytes);
+    fflush(stdout);
+}
+
+// fixed seed xorshift so every run does exactly the same work
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void fill_noise(int16_t* buf, size_t len, int amplitude) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (int16_t)((int)(rng_next() % (2 * amplitude + 1)) - amplitude);
+    }
+}
+
+static struct sound_seg* make_track(size_t len, int amplitude) {
+    struct sound_seg* seg = tr_init();
+    int16_t* buf = malloc(len * sizeof(int16_t));
+    if (seg == NULL || buf == NULL) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    fill_noise(buf, len, amplitude);
+    tr_write(seg, buf, 0, len);
+    free(buf);
+    return seg;
+}
+
+static void bench_long_track(void) {
+    size_t chunk = SAMPLE_RATE; // one second per write
+    size_t total = (size_t)LONG_TRACK_SECONDS * SAMPLE_RATE;
+    int16_t* buf = malloc(chunk * sizeof(int16_t));
+    fill_noise(buf, chunk, 10000);
+
+    BenchMark mark;
+    struct sound_seg* track = tr_init();
+
+    bench_begin(&mark);
+    for (size_t pos = 0; pos < total; pos += chunk) {
+        tr_write(track, buf, pos, chunk);
+    }
+    bench_end(&mark, "long_track_append_1s_writes", total / chunk, total);
+
+    int16_t* out = malloc(total * sizeof(int16_t));
+    bench_begin(&mark);
+    tr_read(track, out, 0, total);
+    bench_end(&mark, "long_track_full_read", 1, total);
+
+    size_t reads = 100000;
+    size_t read_len = 256;
+    bench_begin(&mark);
+    for (size_t i = 0; i < reads; i++) {
+        tr_read(track, out, rng_next() % (total - read_len), read_len);
+    }
+    bench_end(&mark, "long_track_random_256_reads", reads, reads * read_len);
+
+    free(out);
+    free(buf);
+    tr_destroy(track);
+}
+
+static void bench_effects_read(void) {
+    size_t len = 10 * 60 * SAMPLE_RATE;
+    struct sound_seg* track = make_track(len, 10000);
+    int16_t* out = malloc(len * sizeof(int16_t));
+
+    tr_add_effect(track, TR_EFFECT_GAIN, 0, len, 0.8, 0);
+    tr_add_effect(track, TR_EFFECT_FADE, 0, SAMPLE_RATE * 5, 0.0, 1.0);
+    tr_add_effect(track, TR_EFFECT_REVERSE, len / 4, len / 2, 0, 0);
+    tr_add_effect(track, TR_EFFECT_DC_OFFSET, 0, len, -12, 0);
+
+    BenchMark mark;
+    bench_begin(&mark);
+    tr_read(track, out, 0, len);
+    bench_end(&mark, "effects_4_stacked_full_read", 1, len);
+
+    free(out);
+    tr_destroy(track);
+}
+
+static void bench_delete_churn(void) {
+    size_t ops = 20000;
+    size_t len = 100;
+    struct sound_seg* track = make_track(10 * 60 * SAMPLE_RATE, 10000);
+    int16_t buf[100];
+    fill_noise(buf, len, 10000);
+
+    BenchMark mark;
+    bench_begin(&mark);
+    for (size_t i = 0; i < ops; i++) {
+        // cut a bit out somewhere and put the same amount back on the end, so the length holds steady
+        tr_delete_range(track, rng_next() % (tr_length(track) - len), len);
+        tr_write(track, buf, tr_length(track), len);
+    }
+    bench_end(&mark, "tr_delete_range_churn", ops, ops * len);
+
+    tr_destroy(track);
+}
+
+static void bench_stereo(void) {
+    size_t frames = 10 * 60 * SAMPLE_RATE;
+    int16_t* buf = malloc(frames * 2 * sizeof(int16_t));
+    fill_noise(buf, frames * 2, 10000);
+
+    struct sound_seg* track = tr_init_channels(2, TR_LAYOUT_INTERLEAVED);
+    tr_write(track, buf, 0, frames);
+
+    BenchMark mark;
+    bench_begin(&mark);
+    tr_set_layout(track, TR_LAYOUT_PLANAR);
+    tr_set_layout(track, TR_LAYOUT_INTERLEAVED);
+    bench_end(&mark, "stereo_layout_transpose_round_trip", 2, 2 * frames * 2);
+
+    tr_set_layout(track, TR_LAYOUT_PLANAR);
+    bench_begin(&mark);
+    tr_read(track, buf, 0, frames);
+    bench_end(&mark, "stereo_planar_full_read", 1, frames * 2);
+
+    size_t ops = 2000;
+    bench_begin(&mark);
+    for (size_t i = 0; i < ops; i++) {
+        tr_delete_range(track, rng_next() % (tr_length(track) - 100), 100);
+        tr_write(track, buf, tr_length(track), 100);
+    }
+    bench_end(&mark, "stereo_planar_delete_range_churn", ops, ops * 100 * 2);
+
+    free(buf);
+    tr_destroy(track);
+}
+
+static void bench_identify(void) {
+    size_t target_len = 60 * SAMPLE_RATE;
+    size_t ad_lens[] = { 80, 800, 4000 };
+
+    for (size_t a = 0; a < sizeof(ad_lens) / sizeof(ad_lens[0]); a++) {
+        size_t ad_len = ad_lens[a];
+        int16_t* target_buf = malloc(target_len * sizeof(int16_t));
+        int16_t* ad_buf = malloc(ad_len * sizeof(int16_t));
+        fill_noise(target_buf, target_len, 300);
+        fill_noise(ad_buf, ad_len, 10000);
+
+        // plant a handful of copies of the ad
+        for (size_t k = 0; k < 8; k++) {
+            memcpy(target_buf + (k + 1) * (target_len / 10), ad_buf, ad_len * sizeof(int16_t));
+        }
+
+        struct sound_seg* target = tr_init();
+        struct sound_seg* ad = tr_init();
+        tr_write(target, target_buf, 0, target_len);
+        tr_write(ad, ad_buf, 0, ad_len);
+
+        char name[64];
+        BenchMark mark;
+
+        snprintf(name, sizeof(name), "tr_identify_ad_%zu", ad_len);
+        bench_begin(&mark);
+        char* result = tr_identify(target, ad);
+        bench_end(&mark, name, 1, target_len);
+        free(result);
+
+        struct tr_match matches[16];
+        struct tr_identify_opts opts = { 0.95, 4, TR_OVERLAP_SKIP };
+        snprintf(name, sizeof(name), "tr_identify_matches_top4_ad_%zu", ad_len);
+        bench_begin(&mark);
+        tr_identify_matches(target, ad, &opts, matches, 16);
+        bench_end(&mark, name, 1, target_len);
+
+        tr_destroy(target);
+        tr_destroy(ad);
+        free(target_buf);
+        free(ad_buf);
+    }
+}
+
+static void bench_wav_round_trip(const char* dir) {
+    size_t len = 5 * 60 * SAMPLE_RATE;
+    size_t reps = 10;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/round_trip.wav", dir);
+
+    struct sound_seg* track = make_track(len, 10000);
+    int16_t* buf = malloc(len * sizeof(int16_t));
+    tr_read(track, buf, 0, len);
+
+    BenchMark mark;
+    bench_begin(&mark);
+    for (size_t i = 0; i < reps; i++) {
+        wav_save(path, buf, len);
+        wav_load(path, buf);
+    }
+    bench_end(&mark, "wav_save_load_round_trip", reps, reps * len);
+
+    bench_begin(&mark);
+    for (size_t i = 0; i < reps; i++) {
+        wav_save_seg(path, track);
+    }
+    bench_end(&mark, "wav_save_seg", reps, reps * len);
+
+    remove(path);
+    free(buf);
+    tr_destroy(track);
+}
+
+static void bench_batch_load(const char* dir) {
+    size_t clips = 500;
+    size_t clip_len = 2 * SAMPLE_RATE;
+    int16_t* buf = malloc(clip_len * sizeof(int16_t));
+    char** paths = malloc(clips * sizeof(char*));
+    fill_noise(buf, clip_len, 10000);
+
+    for (size_t i = 0; i < clips; i++) {
+        paths[i] = malloc(512);
+        snprintf(paths[i], 512, "%s/clip_%zu.wav", dir, i);
+        wav_save(paths[i], buf, clip_len);
+    }
+
+    BenchMark mark;
+    bench_begin(&mark);
+    struct sound_seg** segs = wav_load_batch((const char* const*)paths, clips, 0);
+    bench_end(&mark, "wav_load_batch_500_clips", clips, clips * clip_len);
+
+    for (size_t i = 0; i < clips; i++) {
+        tr_destroy(segs[i]);
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(segs);
+    free(paths);
+    free(buf);
+}
+
+static void bench_project(const char* dir) {
+    size_t len = 30 * 60 * SAMPLE_RATE;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/session.trp", dir);
+
+    struct sound_seg* track = make_track(len, 10000);
+    int16_t edit[64];
+    fill_noise(edit, 64, 10000);
+
+    BenchMark mark;
+    bench_begin(&mark);
+    tr_project_save(path, track);
+    bench_end(&mark, "project_first_save", 1, len);
+
+    size_t edits = 20;
+    bench_begin(&mark);
+    for (size_t i = 0; i < edits; i++) {
+        tr_write(track, edit, rng_next() % (len - 64), 64);
+        tr_project_save(path, track);
+    }
+    bench_end(&mark, "project_incremental_save", edits, 0);
+
+    bench_begin(&mark);
+    struct sound_seg* loaded = tr_project_load(path);
+    bench_end(&mark, "project_load", 1, len);
+
+    remove(path);
+    tr_destroy(loaded);
+    tr_destroy(track);
+}
+
+#ifdef TR_STATS
+// with make bench STATS=1 the library's own counters get dumped after the timings
+static void print_stats(void) {
+    static const char* op_names[TR_OP_COUNT] = { "read", "write", "delete_range", "insert", "identify", "flatten" };
+    struct tr_stats stats;
+    tr_stats_get(&stats);
+
+    for (size_t op = 0; op < TR_OP_COUNT; op++) {
+        const struct tr_op_stats* s = &stats.ops[op];
+        printf("{\"stats\":\"%s\",\"calls\":%llu,\"bytes_copied\":%llu,\"allocs\":%llu,\"total_ns\":%llu,\"latency_log2_ns\":[",
+               op_names[op], (unsigned long long)s->calls, (unsigned long long)s->bytes_copied,
+               (unsigned long long)s->allocs, (unsigned long long)s->total_ns);
+        for (size_t b = 0; b < TR_STATS_BUCKETS; b++) {
+            printf(b > 0 ? ",%llu" : "%llu", (unsigned long long)s->latency_hist[b]);
+        }
+        printf("]}\n");
+    }
+    printf("{\"stats\":\"chain\",\"max_chain_depth\":%llu}\n", (unsigned long long)stats.max_chain_depth);
+}
+#endif
+
+int main(void) {
+    char dir[] = "/tmp/sound_seg_bench_XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    bench_long_track();
+    bench_effects_read();
+    // no tr_insert workload: the split it relies on works on a copy of the right half that never gets
+    // linked in, so it times a no-op. add one once inserts actually splice
+    bench_delete_churn();
+    bench_stereo();
+    bench_identify();
+    bench_wav_round_trip(dir);
+    bench_batch_load(dir);
+    bench_project(dir);
+
+#ifdef TR_STATS
+    print_stats();
+#endif
+
+    rmdir(dir);
+    return 0;
+}
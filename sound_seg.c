@@ -4,15 +4,55 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "sound_seg.h"
 
 
+/*
+length and capacity count frames (one sample per channel). data holds capacity * channels samples:
+    interleaved: frame f channel c lives at data[f * channels + c]  (how WAV stores it)
+    planar:      frame f channel c lives at data[c * capacity + f]  (one contiguous run per channel)
+mono is the same either way
+*/
 typedef struct {
     int16_t* data; 
     size_t length; 
     size_t capacity;
+    uint16_t channels;
+    enum tr_layout layout;
 
 } Track;
 
+// a lazy effect node: nothing is touched until someone reads the samples
+typedef struct {
+    enum tr_effect_type type;
+    size_t pos;
+    size_t len;
+    double a;
+    double b;
+} Effect;
+
+// where one block of a segment's samples went the last time it was saved to (or loaded from) a project
+typedef struct {
+    size_t run;
+    size_t start; // samples into the run
+    size_t len;
+    uint64_t offset; // BLK record in the project file, 0 once an edit has touched these samples
+    uint64_t hash; // of the samples, has to match the record's before the block is reused
+} SavedBlock;
+
+typedef struct {
+    uint64_t project_id; // the project the offsets point into
+    SavedBlock* blocks; // sorted by run then start
+    size_t count;
+} SavedBlocks;
+
 struct sound_seg {
     
     Track track;
@@ -28,10 +68,221 @@ struct sound_seg {
     size_t num_children;
     size_t num_children_capacity;
 
+    Effect* effects; // applied in order, evaluated at read time
+    size_t num_effects;
+    size_t effects_capacity;
 
+    SavedBlocks saved; // lets the next project save skip samples nothing has touched
 
 };
 
+/*
+hot path counters, only compiled in with -DTR_STATS (make STATS=1). without it every STAT_ macro
+expands to nothing and tr_stats_get just hands back zeros, so a normal build pays nothing.
+like the rest of the tr_ functions these aren't thread safe
+*/
+
+#ifdef TR_STATS
+
+static struct tr_stats stats;
+static uint64_t stat_depth;
+
+static uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void stats_record(enum tr_stat_op op, uint64_t start) {
+    uint64_t ns = stats_now() - start;
+    size_t bucket = ns > 0 ? 63 - (size_t)__builtin_clzll(ns) : 0;
+    if (bucket >= TR_STATS_BUCKETS) bucket = TR_STATS_BUCKETS - 1;
+
+    stats.ops[op].calls++;
+    stats.ops[op].total_ns += ns;
+    stats.ops[op].latency_hist[bucket]++;
+}
+
+#define STAT_TIMER_START() uint64_t stat_start = stats_now()
+#define STAT_TIMER_END(op) stats_record((op), stat_start)
+#define STAT_BYTES(op, n) (stats.ops[(op)].bytes_copied += (n))
+#define STAT_ALLOC(op) (stats.ops[(op)].allocs++)
+#define STAT_DEPTH_PUSH() (++stat_depth > stats.max_chain_depth ? (void)(stats.max_chain_depth = stat_depth) : (void)0)
+#define STAT_DEPTH_POP() (stat_depth--)
+
+void tr_stats_get(struct tr_stats* out) {
+    if (out != NULL) *out = stats;
+}
+
+void tr_stats_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+#else
+
+#define STAT_TIMER_START() ((void)0)
+#define STAT_TIMER_END(op) ((void)0)
+#define STAT_BYTES(op, n) ((void)(op)) // op is still "used", so passing it down doesn't trip -Wunused-parameter
+#define STAT_ALLOC(op) ((void)(op))
+#define STAT_DEPTH_PUSH() ((void)0)
+#define STAT_DEPTH_POP() ((void)0)
+
+void tr_stats_get(struct tr_stats* out) {
+    if (out != NULL) memset(out, 0, sizeof(*out));
+}
+
+void tr_stats_reset(void) {
+}
+
+#endif
+
+/*
+layout transposes. the stereo case is split out into its own functions so both planes are separate
+restrict parameters (restrict locals inside one function didn't stop gcc versioning the loops for
+aliasing) and the stride is a constant. -O2 only vectorises loops its "very cheap" cost model likes,
+which these aren't, so they ask for loop vectorisation themselves: -fopt-info-vec reports both
+vectorised with 16 byte vectors at -O2
+*/
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define TR_VECTORIZE __attribute__((optimize("tree-loop-vectorize")))
+#else
+#define TR_VECTORIZE
+#endif
+
+TR_VECTORIZE
+static void deinterleave_stereo(const int16_t* restrict src, int16_t* restrict left, int16_t* restrict right,
+                                size_t frames) {
+    for (size_t f = 0; f < frames; f++) {
+        left[f] = src[2 * f];
+        right[f] = src[2 * f + 1];
+    }
+}
+
+TR_VECTORIZE
+static void interleave_stereo(const int16_t* restrict left, const int16_t* restrict right, int16_t* restrict dest,
+                              size_t frames) {
+    for (size_t f = 0; f < frames; f++) {
+        dest[2 * f] = left[f];
+        dest[2 * f + 1] = right[f];
+    }
+}
+
+static void interleaved_to_planar(const int16_t* restrict src, int16_t* restrict dest, size_t frames,
+                                  uint16_t channels, size_t stride) {
+    if (channels == 1) {
+        memcpy(dest, src, frames * sizeof(int16_t));
+    } else if (channels == 2) {
+        deinterleave_stereo(src, dest, dest + stride, frames);
+    } else {
+        for (uint16_t c = 0; c < channels; c++) {
+            int16_t* restrict plane = dest + c * stride;
+            for (size_t f = 0; f < frames; f++) {
+                plane[f] = src[f * channels + c];
+            }
+        }
+    }
+}
+
+static void planar_to_interleaved(const int16_t* restrict src, int16_t* restrict dest, size_t frames,
+                                  uint16_t channels, size_t stride) {
+    if (channels == 1) {
+        memcpy(dest, src, frames * sizeof(int16_t));
+    } else if (channels == 2) {
+        interleave_stereo(src, src + stride, dest, frames);
+    } else {
+        for (uint16_t c = 0; c < channels; c++) {
+            const int16_t* restrict plane = src + c * stride;
+            for (size_t f = 0; f < frames; f++) {
+                dest[f * channels + c] = plane[f];
+            }
+        }
+    }
+}
+
+// Make room for at least frames frames, doubling like tr_write always has
+static bool track_reserve(Track* track, size_t frames) {
+    if (frames <= track->capacity) return true;
+
+    size_t new_capacity = track->capacity > 0 ? track->capacity : 1;
+    while (new_capacity < frames) {
+        new_capacity *= 2;
+    }
+
+    if (track->layout == TR_LAYOUT_INTERLEAVED || track->channels == 1) {
+        int16_t* new_data = realloc(track->data, new_capacity * track->channels * sizeof(int16_t));
+        if (new_data == NULL) return false;
+        track->data = new_data;
+    } else {
+        // planes sit capacity apart, so they all have to move to the new stride
+        int16_t* new_data = malloc(new_capacity * track->channels * sizeof(int16_t));
+        if (new_data == NULL) return false;
+        for (uint16_t c = 0; c < track->channels; c++) {
+            memcpy(new_data + c * new_capacity, track->data + c * track->capacity, track->capacity * sizeof(int16_t));
+        }
+        free(track->data);
+        track->data = new_data;
+    }
+
+    track->capacity = new_capacity;
+    return true;
+}
+
+// First saved block of run that ends past sample pos
+static size_t saved_block_search(const SavedBlocks* saved, size_t run, size_t pos) {
+    size_t lo = 0, hi = saved->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const SavedBlock* block = &saved->blocks[mid];
+        if (block->run < run || (block->run == run && block->start + block->len <= pos)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*
+keep the blocks from the last project save honest after frames [pos, pos + len) change: the blocks
+overlapping them no longer match the samples and get dropped, and if the frames were cut out (a delete)
+everything after them slides back to where the samples now are
+*/
+static void saved_blocks_edit(struct sound_seg* seg, size_t pos, size_t len, bool removed) {
+    SavedBlocks* saved = &seg->saved;
+    if (saved->count == 0 || len == 0) return;
+
+    bool planar = seg->track.layout == TR_LAYOUT_PLANAR;
+    size_t unit = planar ? 1 : seg->track.channels;
+    size_t runs = planar ? seg->track.channels : 1;
+    size_t lo = pos * unit;
+    size_t hi = (pos + len) * unit;
+
+    if (!removed) {
+        for (size_t run = 0; run < runs; run++) {
+            for (size_t i = saved_block_search(saved, run, lo); i < saved->count; i++) {
+                SavedBlock* block = &saved->blocks[i];
+                if (block->run != run || block->start >= hi) break;
+                block->offset = 0;
+            }
+        }
+        return;
+    }
+
+    // a delete moves every later block anyway, so compact the dropped ones out while we're at it
+    size_t kept = 0;
+    for (size_t i = 0; i < saved->count; i++) {
+        SavedBlock block = saved->blocks[i];
+        if (block.offset == 0 || (block.start < hi && block.start + block.len > lo)) continue;
+        if (block.start >= hi) block.start -= hi - lo;
+        saved->blocks[kept++] = block;
+    }
+    saved->count = kept;
+}
+
+static void saved_blocks_clear(struct sound_seg* seg) {
+    free(seg->saved.blocks);
+    seg->saved.blocks = NULL;
+    seg->saved.count = 0;
+}
+
 // Load a WAV file into buffer
 void wav_load(const char* filename, int16_t* dest) {
     FILE* file = fopen(filename, "rb");
@@ -43,24 +294,19 @@ void wav_load(const char* filename, int16_t* dest) {
     // WAV header is 44 bytes for standard PCM
     fseek(file, 44, SEEK_SET);
 
-    // Read data until end of file
+    // Read data until end of file, a block at a time rather than one fread per sample
     size_t index = 0;
-    while (fread(&dest[index], sizeof(int16_t), 1, file) == 1) {
-        index++;
+    size_t got;
+    while ((got = fread(&dest[index], sizeof(int16_t), 4096, file)) > 0) {
+        index += got;
     }
 
     fclose(file);
 }
 
 
-// Create/write a WAV file from buffer
-void wav_save(const char* filename, const int16_t* src, size_t len) {
-    FILE* file = fopen(filename, "wb");
-    if (!file) {
-        perror("Failed to open file");
-        return;
-    }
-
+// Write the 44 byte PCM header for len frames of num_channels interleaved samples
+static void wav_write_header(FILE* file, size_t len, uint16_t num_channels) {
     /* 
 
     WAV file format:
@@ -86,11 +332,10 @@ void wav_save(const char* filename, const int16_t* src, size_t len) {
 
     uint32_t sample_rate = 8000;
     uint16_t bits_per_sample = 16;
-    uint16_t num_channels = 1;
 
     uint32_t byte_rate = sample_rate * num_channels * (bits_per_sample / 8);
     uint16_t block_align = num_channels * (bits_per_sample / 8);
-    uint32_t data_chunk_size = len * sizeof(int16_t);
+    uint32_t data_chunk_size = len * num_channels * sizeof(int16_t);
     uint32_t riff_chunk_size = 36 + data_chunk_size;
 
     // Write the header
@@ -111,21 +356,36 @@ void wav_save(const char* filename, const int16_t* src, size_t len) {
 
     fwrite("data", 1, 4, file);
     fwrite(&data_chunk_size, 4, 1, file);
+}
+
+// Create/write a WAV file from buffer
+void wav_save(const char* filename, const int16_t* src, size_t len) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        perror("Failed to open file");
+        return;
+    }
+
+    wav_write_header(file, len, 1);
     fwrite(src, sizeof(int16_t), len, file);
 
     fclose(file);
 }
 
 
-// Initialize a new sound_seg object
-struct sound_seg* tr_init() {
+// Initialize a new sound_seg object with the given channel count and sample layout
+struct sound_seg* tr_init_channels(uint16_t channels, enum tr_layout layout) {
+    if (channels == 0) return NULL;
+
     struct sound_seg* segment = calloc(1, sizeof(struct sound_seg));
     if (segment == NULL) return NULL;
 
     segment->track.length = 0;
     segment->track.capacity = 8; //small default size which != 0 so that we can reallocate multiplicatively if needed
+    segment->track.channels = channels;
+    segment->track.layout = layout;
 
-    segment->track.data = calloc(segment->track.capacity, sizeof(int16_t));
+    segment->track.data = calloc(segment->track.capacity * channels, sizeof(int16_t));
 
     if (segment->track.data == NULL) {
         free(segment);
@@ -139,27 +399,22 @@ struct sound_seg* tr_init() {
     segment->children = NULL;
     segment->num_children = 0;
     segment->num_children_capacity = 1;
-    
-
-    // = malloc(sizeof(struct sound_seg*) * 1);
-    // if (segment->children == NULL) {
-    //     free(segment->track.data);
-    //     free(segment->track_ptrs);
-        
-    //     free(segment);
-    //     return NULL;
-    // }
-
-    
 
     return segment;
 }
 
+// Initialize a new (mono) sound_seg object
+struct sound_seg* tr_init() {
+    return tr_init_channels(1, TR_LAYOUT_INTERLEAVED);
+}
+
 // Destroy a sound_seg object and free all allocated memory
 void tr_destroy(struct sound_seg* obj) {
     if (obj == NULL) return;
 
     free(obj->track.data);
+    free(obj->effects);
+    free(obj->saved.blocks);
     // free(obj->track_ptrs);
 
     for (size_t i = 0; i < obj->num_children; i++) {
@@ -171,12 +426,231 @@ void tr_destroy(struct sound_seg* obj) {
     return;
 }
 
-// Return the length of the segment
+// Return the length of the segment (in frames)
 size_t tr_length(struct sound_seg* seg) {
     if (seg == NULL) return 0;
     return seg->track.length;
 }
 
+uint16_t tr_channels(struct sound_seg* seg) {
+    if (seg == NULL) return 0;
+    return seg->track.channels;
+}
+
+enum tr_layout tr_get_layout(struct sound_seg* seg) {
+    if (seg == NULL) return TR_LAYOUT_INTERLEAVED;
+    return seg->track.layout;
+}
+
+// Switch how seg stores its samples, the audio itself doesn't change
+bool tr_set_layout(struct sound_seg* seg, enum tr_layout layout) {
+    if (seg == NULL) return false;
+
+    Track* track = &seg->track;
+    if (track->layout == layout) return true;
+    if (track->channels == 1) {
+        track->layout = layout;
+        return true;
+    }
+
+    int16_t* new_data = malloc(track->capacity * track->channels * sizeof(int16_t));
+    if (new_data == NULL) return false;
+
+    if (layout == TR_LAYOUT_PLANAR) {
+        interleaved_to_planar(track->data, new_data, track->length, track->channels, track->capacity);
+    } else {
+        planar_to_interleaved(track->data, new_data, track->length, track->channels, track->capacity);
+    }
+
+    free(track->data);
+    track->data = new_data;
+    track->layout = layout;
+    saved_blocks_clear(seg); // the runs the blocks were cut from are gone
+    return true;
+}
+
+// Contiguous samples of one channel of a planar segment (length tr_length), NULL if seg is interleaved
+const int16_t* tr_channel_data(struct sound_seg* seg, uint16_t channel) {
+    if (seg == NULL || channel >= seg->track.channels) return NULL;
+    if (seg->track.layout != TR_LAYOUT_PLANAR && seg->track.channels > 1) return NULL;
+    return seg->track.data + channel * seg->track.capacity;
+}
+
+
+/*
+batch loading for when we need thousands of clips at once. wav_load does one file at a time, so here
+a small pool of worker threads pulls paths off a shared counter and each file costs a small pread per
+RIFF chunk header plus one bulk pread straight into the new segment's buffer (no per-sample syscalls,
+no intermediate copy)
+*/
+
+typedef struct {
+    const char* const* paths;
+    struct sound_seg** out;
+    size_t count;
+    atomic_size_t next;
+} BatchLoad;
+
+static uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_le16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE // what anything past stereo is written as
+
+// KSDATAFORMAT_SUBTYPE_PCM, the sub format an extensible fmt chunk names for plain PCM
+static const uint8_t wav_subformat_pcm[16] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                                               0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+
+static bool pread_all(int fd, void* buf, size_t len, size_t offset) {
+    return pread(fd, buf, len, (off_t)offset) == (ssize_t)len;
+}
+
+// Walk the RIFF chunks for the format and the data chunk, one small pread per chunk header however far
+// into the file they sit. only 16 bit PCM (plain or extensible) is accepted, and anything we can't make
+// sense of is rejected, not guessed at
+static bool wav_find_data(int fd, size_t file_size, size_t* data_off, size_t* data_len, uint16_t* channels) {
+    uint8_t riff[12];
+    if (file_size < 12 || !pread_all(fd, riff, sizeof(riff), 0)) return false;
+    if (memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) return false;
+
+    bool have_fmt = false;
+    size_t pos = 12;
+    while (pos + 8 <= file_size) {
+        uint8_t chunk[8];
+        if (!pread_all(fd, chunk, sizeof(chunk), pos)) return false;
+        uint32_t chunk_size = read_le32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            // 16 bytes of plain fmt, 40 when extensible (cbSize, valid bits, channel mask, sub format)
+            uint8_t fmt[40];
+            size_t fmt_len = chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt);
+            if (chunk_size < 16 || !pread_all(fd, fmt, fmt_len, pos + 8)) return false;
+
+            uint16_t audio_format = read_le16(fmt);
+            *channels = read_le16(fmt + 2);
+            uint16_t bits_per_sample = read_le16(fmt + 14);
+            if (audio_format == WAV_FORMAT_EXTENSIBLE) {
+                if (fmt_len < 40 || memcmp(fmt + 24, wav_subformat_pcm, sizeof(wav_subformat_pcm)) != 0) return false;
+            } else if (audio_format != WAV_FORMAT_PCM) {
+                return false;
+            }
+            if (bits_per_sample != 16 || *channels == 0) return false;
+            have_fmt = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt) return false;
+            *data_off = pos + 8;
+            // the chunk size bounds the audio, whatever follows (LIST, id3...) isn't samples
+            size_t available = file_size > *data_off ? file_size - *data_off : 0;
+            *data_len = chunk_size < available ? chunk_size : available;
+            return true;
+        }
+
+        pos += 8 + (size_t)chunk_size + (chunk_size & 1);
+    }
+
+    return false;
+}
+
+static struct sound_seg* wav_load_one(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    size_t data_off, data_len;
+    uint16_t channels;
+    if (fstat(fd, &st) != 0 || !wav_find_data(fd, (size_t)st.st_size, &data_off, &data_len, &channels)) {
+        close(fd);
+        return NULL;
+    }
+
+    posix_fadvise(fd, (off_t)data_off, (off_t)data_len, POSIX_FADV_SEQUENTIAL);
+
+    // WAV data is interleaved, so that's the layout the segment starts out in
+    struct sound_seg* seg = tr_init_channels(channels, TR_LAYOUT_INTERLEAVED);
+    if (seg == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t frames = data_len / (channels * sizeof(int16_t));
+    if (frames > seg->track.capacity) {
+        int16_t* new_data = realloc(seg->track.data, frames * channels * sizeof(int16_t));
+        if (new_data == NULL) {
+            tr_destroy(seg);
+            close(fd);
+            return NULL;
+        }
+        seg->track.data = new_data;
+        seg->track.capacity = frames;
+    }
+
+    // samples are little endian int16 on disk, same as in memory, so read them straight in
+    size_t done = 0;
+    size_t want = frames * channels * sizeof(int16_t);
+    while (done < want) {
+        ssize_t got = pread(fd, (char*)seg->track.data + done, want - done, (off_t)(data_off + done));
+        if (got <= 0) break;
+        done += (size_t)got;
+    }
+    seg->track.length = done / (channels * sizeof(int16_t));
+
+    close(fd);
+    return seg;
+}
+
+static void* wav_load_worker(void* arg) {
+    BatchLoad* job = arg;
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->count) break;
+        job->out[i] = wav_load_one(job->paths[i]);
+    }
+
+    return NULL;
+}
+
+// Load count WAV files in parallel. Returns an array of count segments (NULL where a file couldn't be read
+// or isn't 16 bit PCM), free each with tr_destroy and the array with free. num_threads == 0 means one per cpu
+struct sound_seg** wav_load_batch(const char* const* paths, size_t count, size_t num_threads) {
+    if (paths == NULL) return NULL;
+
+    struct sound_seg** out = calloc(count > 0 ? count : 1, sizeof(struct sound_seg*));
+    if (out == NULL) return NULL;
+
+    if (num_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? (size_t)cpus : 1;
+    }
+    if (num_threads > count) num_threads = count;
+
+    BatchLoad job = { .paths = paths, .out = out, .count = count };
+    atomic_init(&job.next, 0);
+
+    pthread_t* threads = num_threads > 1 ? malloc((num_threads - 1) * sizeof(pthread_t)) : NULL;
+    size_t started = 0;
+    if (threads != NULL) {
+        while (started < num_threads - 1 && pthread_create(&threads[started], NULL, wav_load_worker, &job) == 0) {
+            started++;
+        }
+    }
+
+    // the calling thread works too, so this still finishes if no threads could be started
+    wav_load_worker(&job);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    return out;
+}
+
 
 /*
 so since i have the most confusing linked-sound-segment structure in whole wide world, 
@@ -204,13 +678,85 @@ size_t get_total_len_recursive(struct sound_seg* seg) {
     return total_len;
 }
 
+/*
+effects are never baked into track.data. instead every effect node on a segment gets folded into
+a single pass over the samples at read time: walking the effect list backwards, reverse nodes remap the
+source index and gain/fade/dc nodes collapse into one y = scale * x + offset per sample.
+so stacking effects costs no extra memory and a chain of edits is still one pass over the data
+*/
+
+static int16_t clamp_sample(double value) {
+    if (value >= 32767.0) return 32767;
+    if (value <= -32768.0) return -32768;
+    return (int16_t)(value < 0 ? value - 0.5 : value + 0.5);
+}
+
+// Gain a FADE node applies at idx, ramping from a at its first frame to b at its last
+static double fade_gain(const Effect* fx, size_t idx) {
+    double t = fx->len > 1 ? (double)(idx - fx->pos) / (double)(fx->len - 1) : 0.0;
+    return fx->a + (fx->b - fx->a) * t;
+}
+
+// Render frames [pos, pos + len) of seg's own track into dest (interleaved) with its effects applied
+static void render_samples(struct sound_seg* seg, int16_t* dest, size_t pos, size_t len) {
+    const Track* track = &seg->track;
+    uint16_t channels = track->channels;
+    bool planar = track->layout == TR_LAYOUT_PLANAR;
+
+    if (seg->num_effects == 0) {
+        if (planar) planar_to_interleaved(track->data + pos, dest, len, channels, track->capacity);
+        else memcpy(dest, track->data + pos * channels, len * channels * sizeof(int16_t));
+        return;
+    }
+
+    size_t track_len = track->length;
+
+    for (size_t k = 0; k < len; k++) {
+        size_t idx = pos + k;
+        double scale = 1.0;
+        double offset = 0.0;
+
+        for (size_t e = seg->num_effects; e-- > 0;) {
+            const Effect* fx = &seg->effects[e];
+            size_t end = fx->pos + fx->len < track_len ? fx->pos + fx->len : track_len;
+            if (idx < fx->pos || idx >= end) continue;
+
+            switch (fx->type) {
+            case TR_EFFECT_GAIN:
+                scale *= fx->a;
+                break;
+            case TR_EFFECT_FADE:
+                scale *= fade_gain(fx, idx);
+                break;
+            case TR_EFFECT_REVERSE:
+                idx = fx->pos + (end - 1 - idx);
+                break;
+            case TR_EFFECT_DC_OFFSET:
+                offset += scale * fx->a;
+                break;
+            }
+        }
+
+        // one edit covers every channel of the frame
+        for (uint16_t c = 0; c < channels; c++) {
+            int16_t sample = planar ? track->data[c * track->capacity + idx] : track->data[idx * channels + c];
+            dest[k * channels + c] = clamp_sample(scale * sample + offset);
+        }
+    }
+}
+
 //outside function would do this: int16_t* flat_buffer = malloc(get_total_len_recursive(seg) * sizeof(int16_t)); 
 
 void flatten_segment(struct sound_seg* seg, int16_t* flat_buffer, size_t* mem_offset) {
     
     
-    memcpy(flat_buffer + *mem_offset, seg->track.data, seg->track.length * sizeof(int16_t));
+    STAT_DEPTH_PUSH();
+    STAT_TIMER_START();
+
+    render_samples(seg, flat_buffer + *mem_offset * seg->track.channels, 0, seg->track.length);
     *mem_offset += seg->track.length;
+    STAT_BYTES(TR_OP_FLATTEN, seg->track.length * seg->track.channels * sizeof(int16_t));
+    STAT_TIMER_END(TR_OP_FLATTEN);
 
     for (size_t i = 0; i < seg->num_track_ptrs; i++) {
 
@@ -219,6 +765,7 @@ void flatten_segment(struct sound_seg* seg, int16_t* flat_buffer, size_t* mem_of
 
     }
 
+    STAT_DEPTH_POP();
     return;
 
 }
@@ -241,66 +788,351 @@ void flatten_segment(struct sound_seg* seg, int16_t* flat_buffer, size_t* mem_of
 void tr_read(struct sound_seg* track, int16_t* dest, size_t pos, size_t len) {
     if (track == NULL || dest == NULL || pos + len > track->track.length) return;
 
-    int16_t* flat_buffer = malloc(get_total_len_recursive(track) * sizeof(int16_t));
+    size_t channels = track->track.channels;
+
+    STAT_TIMER_START();
+    STAT_BYTES(TR_OP_READ, len * channels * sizeof(int16_t));
+
+    // nothing linked on: skip the flat copy and render straight into dest
+    if (track->num_track_ptrs == 0) {
+        render_samples(track, dest, pos, len);
+        STAT_TIMER_END(TR_OP_READ);
+        return;
+    }
+
+    int16_t* flat_buffer = malloc(get_total_len_recursive(track) * channels * sizeof(int16_t));
+    STAT_ALLOC(TR_OP_READ);
     if (flat_buffer == NULL) {
         perror("flat_buffer:");
+        STAT_TIMER_END(TR_OP_READ);
         return;
     }
 
     size_t offset = 0;
     flatten_segment(track, flat_buffer, &offset);
 
-    memcpy(dest, flat_buffer + pos, len * sizeof(int16_t));
+    memcpy(dest, flat_buffer + pos * channels, len * channels * sizeof(int16_t));
 
     free(flat_buffer);
+    STAT_TIMER_END(TR_OP_READ);
+}
+
+// Stream a segment (and everything linked off it) to file through a small chunk buffer of chunk_len samples
+static void save_segment_chunks(FILE* file, struct sound_seg* seg, int16_t* chunk, size_t chunk_len) {
+    size_t channels = seg->track.channels;
+    size_t chunk_frames = chunk_len / channels > 0 ? chunk_len / channels : 1;
+
+    for (size_t pos = 0; pos < seg->track.length; pos += chunk_frames) {
+        size_t n = seg->track.length - pos < chunk_frames ? seg->track.length - pos : chunk_frames;
+        render_samples(seg, chunk, pos, n);
+        fwrite(chunk, sizeof(int16_t), n * channels, file);
+    }
+
+    for (size_t i = 0; i < seg->num_track_ptrs; i++) {
+        save_segment_chunks(file, seg->track_ptrs[i], chunk, chunk_len);
+    }
+}
+
+// Save a segment to a WAV file, applying its effects on the way out (no full-size copy)
+void wav_save_seg(const char* filename, struct sound_seg* seg) {
+    if (seg == NULL) return;
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        perror("Failed to open file");
+        return;
+    }
+
+    // one chunk has to hold at least a whole frame, which caps us at 4096 channels
+    int16_t chunk[4096];
+    wav_write_header(file, get_total_len_recursive(seg), seg->track.channels);
+    save_segment_chunks(file, seg, chunk, sizeof(chunk) / sizeof(chunk[0]));
+
+    fclose(file);
+}
+
+/*
+tr_write and tr_delete_range take positions as tr_read shows them. gain/fade/dc never move samples so
+those positions already line up with track.data, but a REVERSE node does. so before a destructive edit
+every reverse node is baked: its range gets physically reversed, the nodes before it in the chain are
+mirrored (split at the range edges) to follow their samples, and the node itself is dropped.
+what tr_read returns is unchanged by this and the remaining nodes are all position preserving
+*/
+
+static void reverse_frames(Track* track, size_t start, size_t end) {
+    size_t channels = track->channels;
+    bool planar = track->layout == TR_LAYOUT_PLANAR;
+
+    for (size_t i = start, j = end - 1; i < j; i++, j--) {
+        for (size_t c = 0; c < channels; c++) {
+            int16_t* a = planar ? &track->data[c * track->capacity + i] : &track->data[i * channels + c];
+            int16_t* b = planar ? &track->data[c * track->capacity + j] : &track->data[j * channels + c];
+            int16_t tmp = *a;
+            *a = *b;
+            *b = tmp;
+        }
+    }
 }
 
-// Write len elements from src into position pos
+// Append the [start, end) piece of fx to out, mirrored within [lo, hi) if asked
+static void push_effect_piece(Effect* out, size_t* count, const Effect* fx, size_t start, size_t end,
+                              bool mirror, size_t lo, size_t hi) {
+    if (end <= start) return;
+
+    Effect piece = *fx;
+    piece.pos = mirror ? lo + hi - end : start;
+    piece.len = end - start;
+
+    if (fx->type == TR_EFFECT_FADE) {
+        double first = fade_gain(fx, start);
+        double last = fade_gain(fx, end - 1);
+        piece.a = mirror ? last : first;
+        piece.b = mirror ? first : last;
+    }
+
+    out[(*count)++] = piece;
+}
+
+// op is whoever needed the bake, its allocation and its pass over the samples are charged to them
+static bool bake_reverse_effects(struct sound_seg* seg, enum tr_stat_op op) {
+    for (size_t r = 0; r < seg->num_effects; r++) {
+        if (seg->effects[r].type != TR_EFFECT_REVERSE) continue;
+
+        Effect rev = seg->effects[r];
+        size_t lo = rev.pos;
+        size_t hi = rev.pos + rev.len < seg->track.length ? rev.pos + rev.len : seg->track.length;
+
+        // each node before r can become three pieces: before, inside (mirrored) and after the range
+        size_t capacity = 3 * r + (seg->num_effects - r - 1) + 1;
+        Effect* out = malloc(capacity * sizeof(Effect));
+        STAT_ALLOC(op);
+        if (out == NULL) return false;
+
+        size_t count = 0;
+        for (size_t e = 0; e < r; e++) {
+            const Effect* fx = &seg->effects[e];
+            size_t start = fx->pos;
+            size_t end = fx->pos + fx->len;
+
+            if (lo >= hi || end <= lo || start >= hi) {
+                out[count++] = *fx;
+                continue;
+            }
+            push_effect_piece(out, &count, fx, start, lo, false, lo, hi);
+            push_effect_piece(out, &count, fx, start > lo ? start : lo, end < hi ? end : hi, true, lo, hi);
+            push_effect_piece(out, &count, fx, hi, end, false, lo, hi);
+        }
+
+        size_t next = count;
+        for (size_t e = r + 1; e < seg->num_effects; e++) {
+            out[count++] = seg->effects[e];
+        }
+
+        if (lo < hi) {
+            reverse_frames(&seg->track, lo, hi);
+            STAT_BYTES(op, (hi - lo) * seg->track.channels * sizeof(int16_t));
+            saved_blocks_edit(seg, lo, hi - lo, false);
+        }
+
+        free(seg->effects);
+        seg->effects = out;
+        seg->num_effects = count;
+        seg->effects_capacity = capacity;
+
+        r = next - 1; // pick up after the pieces, which can't contain a reverse
+    }
+
+    return true;
+}
+
+// Write len frames (interleaved) from src into position pos
 void tr_write(struct sound_seg* track, int16_t* src, size_t pos, size_t len) {
     if (track == NULL || src == NULL || len == 0) return;
 
+    STAT_TIMER_START();
+    if (!bake_reverse_effects(track, TR_OP_WRITE)) {
+        STAT_TIMER_END(TR_OP_WRITE);
+        return;
+    }
+
+    size_t channels = track->track.channels;
     size_t required = pos + len;
     if (required > track->track.capacity) {
-        size_t new_capacity = track->track.capacity > 0 ? track->track.capacity : 1;
-        while (new_capacity < required) {
-            new_capacity *= 2;
+        STAT_ALLOC(TR_OP_WRITE);
+        if (!track_reserve(&track->track, required)) {
+            STAT_TIMER_END(TR_OP_WRITE);
+            return;
         }
-        int16_t* new_data = realloc(track->track.data, new_capacity * sizeof(int16_t));
-        if (new_data == NULL) return;
-        track->track.data = new_data;
-        track->track.capacity = new_capacity;
     }
 
     
     if (len > 0) {
-        memcpy(track->track.data + pos, src, len * sizeof(int16_t));
+        if (track->track.layout == TR_LAYOUT_PLANAR) {
+            interleaved_to_planar(src, track->track.data + pos, len, track->track.channels, track->track.capacity);
+        } else {
+            memcpy(track->track.data + pos * channels, src, len * channels * sizeof(int16_t));
+        }
+        STAT_BYTES(TR_OP_WRITE, len * channels * sizeof(int16_t));
     }
 
     if (required > track->track.length) {
         track->track.length = required;
     }
+    saved_blocks_edit(track, pos, len, false);
+
+    STAT_TIMER_END(TR_OP_WRITE);
+}
+
+// Attach an effect node to seg, nothing is computed until the samples are read
+bool tr_add_effect(struct sound_seg* seg, enum tr_effect_type type, size_t pos, size_t len, double a, double b) {
+    if (seg == NULL || len == 0) return false;
+
+    if (seg->num_effects == seg->effects_capacity) {
+        size_t new_capacity = seg->effects_capacity > 0 ? seg->effects_capacity * 2 : 4;
+        Effect* new_effects = realloc(seg->effects, new_capacity * sizeof(Effect));
+        if (new_effects == NULL) return false;
+        seg->effects = new_effects;
+        seg->effects_capacity = new_capacity;
+    }
+
+    Effect* fx = &seg->effects[seg->num_effects++];
+    fx->type = type;
+    fx->pos = pos;
+    fx->len = len;
+    fx->a = a;
+    fx->b = b;
+
+    return true;
+}
+
+// Drop every effect node on seg (the underlying samples were never touched)
+void tr_clear_effects(struct sound_seg* seg) {
+    if (seg == NULL) return;
+
+    free(seg->effects);
+    seg->effects = NULL;
+    seg->num_effects = 0;
+    seg->effects_capacity = 0;
+}
+
+/*
+keep effect ranges glued to the samples they were attached to when a range is cut out. a fade keeps the
+gains its surviving samples had, so one cut through the middle becomes two pieces (which can grow the
+list, hence the bool: nothing is touched if that allocation fails)
+*/
+static bool shift_effects_after_delete(struct sound_seg* seg, size_t pos, size_t len) {
+    size_t extra = 0;
+    for (size_t i = 0; i < seg->num_effects; i++) {
+        const Effect* fx = &seg->effects[i];
+        if (fx->type == TR_EFFECT_FADE && fx->pos < pos && fx->pos + fx->len > pos + len) extra++;
+    }
+
+    size_t num = seg->num_effects;
+    if (extra > 0) {
+        if (num + extra > seg->effects_capacity) {
+            Effect* new_effects = realloc(seg->effects, (num + extra) * sizeof(Effect));
+            if (new_effects == NULL) return false;
+            seg->effects = new_effects;
+            seg->effects_capacity = num + extra;
+        }
+        // read from the top of the buffer so the extra pieces never land on a node not yet looked at
+        memmove(seg->effects + extra, seg->effects, num * sizeof(Effect));
+    }
+
+    const Effect* src = seg->effects + extra;
+    size_t kept = 0;
+    for (size_t i = 0; i < num; i++) {
+        Effect fx = src[i];
+        size_t start = fx.pos;
+        size_t end = fx.pos + fx.len;
+
+        if (fx.type == TR_EFFECT_FADE) {
+            // the part before the cut stays put, the part after moves down by len
+            size_t count = kept;
+            push_effect_piece(seg->effects, &kept, &fx, start, end < pos ? end : pos, false, 0, 0);
+            push_effect_piece(seg->effects, &kept, &fx, start > pos + len ? start : pos + len, end, false, 0, 0);
+            for (size_t k = count; k < kept; k++) {
+                if (seg->effects[k].pos >= pos + len) seg->effects[k].pos -= len;
+            }
+            continue;
+        }
+
+        if (start >= pos + len) start -= len;
+        else if (start > pos) start = pos;
+
+        if (end >= pos + len) end -= len;
+        else if (end > pos) end = pos;
+
+        if (end <= start) continue; // whole range was deleted
+
+        fx.pos = start;
+        fx.len = end - start;
+        seg->effects[kept++] = fx;
+    }
+
+    seg->num_effects = kept;
+    return true;
 }
 
 // Delete a range of elements from the track
 bool tr_delete_range(struct sound_seg* track, size_t pos, size_t len) {
     if (track == NULL || len > track->track.length || pos > track->track.length - len) return false;
 
-    // Shift samples forward
-    memmove(track->track.data + pos, track->track.data + pos + len, 
-            (track->track.length - (pos + len)) * sizeof(int16_t));
+    STAT_TIMER_START();
+    if (!bake_reverse_effects(track, TR_OP_DELETE_RANGE)) {
+        STAT_TIMER_END(TR_OP_DELETE_RANGE);
+        return false;
+    }
+
+    // effects first: splitting a fade can need memory, and nothing should have moved if it isn't there
+    if (!shift_effects_after_delete(track, pos, len)) {
+        STAT_TIMER_END(TR_OP_DELETE_RANGE);
+        return false;
+    }
+
+    size_t channels = track->track.channels;
+    size_t tail = track->track.length - (pos + len);
+    bool planar = track->track.layout == TR_LAYOUT_PLANAR && channels > 1;
+
+    // Shift samples forward, every channel at once
+    if (planar) {
+        for (size_t c = 0; c < channels; c++) {
+            int16_t* plane = track->track.data + c * track->track.capacity;
+            memmove(plane + pos, plane + pos + len, tail * sizeof(int16_t));
+        }
+    } else {
+        memmove(track->track.data + pos * channels, track->track.data + (pos + len) * channels,
+                tail * channels * sizeof(int16_t));
+    }
+    STAT_BYTES(TR_OP_DELETE_RANGE, tail * channels * sizeof(int16_t));
     
     track->track.length -= len;
+    saved_blocks_edit(track, pos, len, true);
 
     // Optional: Shrink capacity
     if (track->track.length < track->track.capacity / 2) {
         size_t new_capacity = track->track.capacity / 2;
         if (new_capacity < track->track.length) new_capacity = track->track.length; // Don’t undershoot
-        int16_t* new_data = realloc(track->track.data, new_capacity * sizeof(int16_t));
-        if (new_data == NULL) return false; // Keep old data if fail?
+        if (planar) {
+            // pull the planes in to the smaller stride before the buffer shrinks under them
+            for (size_t c = 1; c < channels; c++) {
+                memmove(track->track.data + c * new_capacity, track->track.data + c * track->track.capacity,
+                        track->track.length * sizeof(int16_t));
+            }
+        }
+        int16_t* new_data = realloc(track->track.data, new_capacity * channels * sizeof(int16_t));
+        STAT_ALLOC(TR_OP_DELETE_RANGE);
+        if (new_data == NULL) {
+            // planes were already moved, so the smaller stride stands even though the buffer didn't shrink
+            if (planar) track->track.capacity = new_capacity;
+            STAT_TIMER_END(TR_OP_DELETE_RANGE);
+            return false; // Keep old data if fail?
+        }
         track->track.data = new_data;
         track->track.capacity = new_capacity;
     }
 
+    STAT_TIMER_END(TR_OP_DELETE_RANGE);
     return true;
 }
 
@@ -314,67 +1146,246 @@ double cross_correlation(const int16_t* data1, const int16_t* data2, size_t len)
     return sum;
 }
 
-// Returns a string containing <start>,<end> ad pairs in target
-char* tr_identify(struct sound_seg* target, struct sound_seg* ad){
-    if (target == NULL || ad == NULL) return strdup("");
+/*
+tr_identify used to snprintf every match into a growing string which callers then had to parse
+straight back out again. the scan now fills tr_match structs directly and the string version just
+formats whatever comes back
+*/
 
-    size_t target_len = target->track.length;
-    size_t ad_len = ad->track.length;
+typedef struct {
+    struct tr_match* matches;
+    size_t count;    // matches reported so far (capped at top_k)
+    size_t stored;   // how many actually sit in matches
+    size_t capacity;
+    bool grow;       // realloc when full instead of dropping matches
+} MatchList;
 
-    double auto_corr = cross_correlation(ad->track.data, ad->track.data, ad_len);
+static void match_swap(struct tr_match* a, struct tr_match* b) {
+    struct tr_match tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
 
+// min-heap on score, so the weakest of the current top k is always at [0]
+static void match_sift_down(struct tr_match* heap, size_t len, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < len && heap[left].score < heap[smallest].score) smallest = left;
+        if (right < len && heap[right].score < heap[smallest].score) smallest = right;
+        if (smallest == i) return;
+        match_swap(&heap[i], &heap[smallest]);
+        i = smallest;
+    }
+}
 
-    size_t buffer_size = 1024; //buffer size for the string
-    size_t buffer_offset = 0; //offset for the buffer
-    char* result = malloc(buffer_size * sizeof(char)); //result string
-    if (result == NULL) return NULL;
+static void match_sift_up(struct tr_match* heap, size_t i) {
+    while (i > 0 && heap[(i - 1) / 2].score > heap[i].score) {
+        match_swap(&heap[i], &heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+}
 
+static bool match_list_reserve(MatchList* list) {
+    if (list->stored < list->capacity) return true;
+    if (!list->grow) return false;
+
+    size_t new_capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+    struct tr_match* new_matches = realloc(list->matches, new_capacity * sizeof(struct tr_match));
+    STAT_ALLOC(TR_OP_IDENTIFY);
+    STAT_BYTES(TR_OP_IDENTIFY, list->stored * sizeof(struct tr_match)); // what realloc may have had to move
+    if (new_matches == NULL) return false;
+    list->matches = new_matches;
+    list->capacity = new_capacity;
+    return true;
+}
 
-    for (size_t i = 0; i <= target_len - ad_len; i++) { //increment by ad_len - 1 to avoid overlap
-        double cross_corr = cross_correlation(target->track.data + i, ad->track.data, ad_len);
-        double similarity = (cross_corr/auto_corr);
+static void match_list_add(MatchList* list, struct tr_match match, size_t top_k) {
+    if (top_k == 0) {
+        if (match_list_reserve(list)) list->matches[list->stored++] = match;
+        list->count++;
+        return;
+    }
 
-        if (similarity >= 0.95) {
-            // printf("match found at %zu\n", i);
-            // printf("similarity: %lf\n", similarity);
-            // printf("cross_corr: %lf\n", cross_corr);
-            // printf("auto_corr: %lf\n", auto_corr);
-
-            int chars = snprintf(NULL, 0, "%zu,%zu", i, i + ad_len - 1); //THIS JUST GETS THE FUCKING LENGTH
-
-            if (buffer_offset + chars + 1 >= buffer_size) { // +1 for null terminator - lol
-                buffer_size *= 2;
-                char* new_result = realloc(result, buffer_size * sizeof(char));
-                if (new_result == NULL) {
-                    free(result);
-                    return NULL;
-                }
-                result = new_result;
-            }
+    if (list->stored < top_k && match_list_reserve(list)) {
+        list->matches[list->stored] = match;
+        match_sift_up(list->matches, list->stored++);
+    } else if (list->stored > 0 && match.score > list->matches[0].score) {
+        list->matches[0] = match;
+        match_sift_down(list->matches, list->stored, 0);
+    }
 
-            if (buffer_offset > 0) {
-                chars = snprintf(result + buffer_offset, buffer_size - buffer_offset, "\n%zu,%zu", i, i + ad_len - 1);
-            } else {
-                chars = snprintf(result + buffer_offset, buffer_size - buffer_offset, "%zu,%zu", i, i + ad_len - 1);
+    if (list->count < top_k) list->count++;
+}
+
+static int match_by_start(const void* a, const void* b) {
+    const struct tr_match* x = a;
+    const struct tr_match* y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// Mono view of a segment for matching: the samples tr_read would give (effects applied), averaged
+// down to one channel. a plain mono track is used as is, anything else is built in a new buffer
+// which the caller frees (*owned tells you which happened)
+static const int16_t* match_view(struct sound_seg* seg, bool* owned) {
+    const Track* track = &seg->track;
+    *owned = false;
+    if (seg->num_effects == 0 && track->channels == 1) return track->data;
+
+    if (seg->num_effects > 0) {
+        size_t channels = track->channels;
+        int16_t* rendered = malloc((track->length > 0 ? track->length : 1) * channels * sizeof(int16_t));
+        STAT_ALLOC(TR_OP_IDENTIFY);
+        if (rendered == NULL) return NULL;
+        render_samples(seg, rendered, 0, track->length);
+        STAT_BYTES(TR_OP_IDENTIFY, track->length * channels * sizeof(int16_t));
+
+        // average each frame in place, frame f only reads from f * channels onwards so nothing is clobbered early
+        if (channels > 1) {
+            for (size_t f = 0; f < track->length; f++) {
+                int32_t sum = 0;
+                for (size_t c = 0; c < channels; c++) sum += rendered[f * channels + c];
+                rendered[f] = (int16_t)(sum / (int32_t)channels);
             }
-            
-            buffer_offset += chars;
+        }
 
+        *owned = true;
+        return rendered;
+    }
 
-            i += ad_len > 1 ? ad_len - 1 : ad_len; //increment by ad_len - 1 to avoid overlap
+    int32_t* sum = calloc(track->length > 0 ? track->length : 1, sizeof(int32_t));
+    int16_t* mono = malloc((track->length > 0 ? track->length : 1) * sizeof(int16_t));
+    STAT_ALLOC(TR_OP_IDENTIFY);
+    STAT_ALLOC(TR_OP_IDENTIFY);
+    if (sum == NULL || mono == NULL) {
+        free(sum);
+        free(mono);
+        return NULL;
+    }
 
+    size_t channels = track->channels;
+    for (size_t c = 0; c < channels; c++) {
+        if (track->layout == TR_LAYOUT_PLANAR) {
+            const int16_t* plane = track->data + c * track->capacity;
+            for (size_t f = 0; f < track->length; f++) sum[f] += plane[f];
+        } else {
+            for (size_t f = 0; f < track->length; f++) sum[f] += track->data[f * channels + c];
         }
+    }
+    for (size_t f = 0; f < track->length; f++) {
+        mono[f] = (int16_t)(sum[f] / (int32_t)channels);
+    }
 
-        
+    STAT_BYTES(TR_OP_IDENTIFY, track->length * channels * sizeof(int16_t));
+    free(sum);
+    *owned = true;
+    return mono;
+}
+
+static void identify_scan(struct sound_seg* target, struct sound_seg* ad, const struct tr_identify_opts* opts, MatchList* list) {
+    STAT_TIMER_START(); // every call counts, including the ones that bail out early
 
+    struct tr_identify_opts defaults = { 0.95, 0, TR_OVERLAP_SKIP };
+    if (opts == NULL) opts = &defaults;
+
+    size_t target_len = target->track.length;
+    size_t ad_len = ad->track.length;
+    bool target_owned = false, ad_owned = false;
+    const int16_t* target_data = NULL;
+    const int16_t* ad_data = NULL;
+    if (ad_len == 0 || ad_len > target_len) goto done;
+
+    target_data = match_view(target, &target_owned);
+    ad_data = match_view(ad, &ad_owned);
+    if (target_data == NULL || ad_data == NULL) goto done;
+
+    double auto_corr = cross_correlation(ad_data, ad_data, ad_len);
+    if (auto_corr <= 0.0) goto done;
+
+    for (size_t i = 0; i <= target_len - ad_len; i++) {
+        double cross_corr = cross_correlation(target_data + i, ad_data, ad_len);
+        double similarity = (cross_corr/auto_corr);
+
+        if (similarity >= opts->threshold) {
+            struct tr_match match = { i, i + ad_len - 1, similarity };
+            match_list_add(list, match, opts->top_k);
+
+            if (opts->overlap == TR_OVERLAP_SKIP) i += ad_len - 1; // resume right after this match
+        }
+    }
+
+    // top k comes out in heap order, hand it back in track order like everything else
+    if (opts->top_k > 0) qsort(list->matches, list->stored, sizeof(struct tr_match), match_by_start);
+
+done:
+    if (target_owned) free((int16_t*)target_data);
+    if (ad_owned) free((int16_t*)ad_data);
+    STAT_TIMER_END(TR_OP_IDENTIFY);
+}
+
+// Fill out with up to out_cap matches of ad in target, returns how many matches there are in total
+// (like snprintf, a return value > out_cap means out was too small). opts may be NULL for the defaults
+size_t tr_identify_matches(struct sound_seg* target, struct sound_seg* ad, const struct tr_identify_opts* opts,
+                           struct tr_match* out, size_t out_cap) {
+    if (target == NULL || ad == NULL) return 0;
+
+    MatchList list = { out, 0, 0, out != NULL ? out_cap : 0, false };
+    identify_scan(target, ad, opts, &list);
+    return list.count;
+}
+
+// Same as tr_identify_matches but the array is allocated for you, free it when done
+struct tr_match* tr_identify_matches_alloc(struct sound_seg* target, struct sound_seg* ad,
+                                           const struct tr_identify_opts* opts, size_t* count) {
+    if (count != NULL) *count = 0;
+    if (target == NULL || ad == NULL || count == NULL) return NULL;
+
+    MatchList list = { NULL, 0, 0, 0, true };
+    identify_scan(target, ad, opts, &list);
+
+    *count = list.stored;
+    return list.matches;
+}
+
+static size_t count_digits(size_t value) {
+    size_t digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        digits++;
     }
+    return digits;
+}
 
-    if (buffer_offset == 0) {
+// Returns a string containing <start>,<end> ad pairs in target
+char* tr_identify(struct sound_seg* target, struct sound_seg* ad){
+    size_t count = 0;
+    struct tr_match* matches = tr_identify_matches_alloc(target, ad, NULL, &count);
+    if (count == 0) {
+        free(matches);
         return strdup("");
     }
 
+    // size the string exactly up front: "start,end" per match plus a newline between them
+    size_t buffer_size = count;
+    for (size_t m = 0; m < count; m++) {
+        buffer_size += count_digits(matches[m].start) + 1 + count_digits(matches[m].end);
+    }
+
+    char* result = malloc(buffer_size * sizeof(char));
+    if (result == NULL) {
+        free(matches);
+        return NULL;
+    }
+
+    size_t buffer_offset = 0;
+    for (size_t m = 0; m < count; m++) {
+        buffer_offset += snprintf(result + buffer_offset, buffer_size - buffer_offset, m > 0 ? "\n%zu,%zu" : "%zu,%zu",
+                                  matches[m].start, matches[m].end);
+    }
+
+    free(matches);
     return result;
-    
 }
 
 
@@ -440,6 +1451,7 @@ void split_track(struct sound_seg* source_track, struct sound_seg* right_track,
         return;
     }
 
+    saved_blocks_edit(source_track, split_pos, right_track_len, false);
     source_track->track.data = temp;
     source_track->track.length = left_track_len;
     source_track->track.capacity = left_track_len;
@@ -488,6 +1500,8 @@ void tr_insert(struct sound_seg* src_track,
 
     if (src_track == NULL || dest_track == NULL || len == 0) return;
 
+    STAT_TIMER_START();
+
     //split the original source track three ways (like slicing a piece of cake twice to extract a slice)
 
     struct sound_seg* clip_track = NULL;
@@ -508,10 +1522,637 @@ void tr_insert(struct sound_seg* src_track,
     link_segments(dest_track, clip_track);
     link_segments(dest_track, rest_of_dest); 
 
+    STAT_TIMER_END(TR_OP_INSERT);
     return;
 }
 
 
+/*
+project files: a way to persist an edit session without flattening it.
+
+the file is a 16 byte header ("TRPJ", version, a random project id) followed by records that are only
+ever appended:
+    BLK  - a chunk of samples keyed by an FNV-1a hash
+    GRF  - a snapshot of the segment graph: every node's length, channels and layout, the blocks
+           holding its samples, its effect nodes and the nodes it links on to (node 0 is the root).
+           version 1 nodes have no channels/layout and are mono, and saving to a version 1 file
+           keeps writing them (so a multi-channel segment can't go into one)
+
+a node's samples are stored as they sit in memory: one run of length * channels samples when
+interleaved, or one run of length samples per channel when planar, with no block crossing a run.
+runs are cut where a rolling hash of the samples says so rather than on a fixed grid, so a delete only
+moves the cut points next to it and the blocks after it still match what's already in the file
+
+saving again only appends blocks that aren't already in the file plus a new GRF. each segment also
+remembers which block of the project holds which of its samples (edits drop the blocks they touch), so
+a save only hashes the samples that changed since the last one. loading mmaps the file and rebuilds the
+graph from the last complete GRF. everything is 8 byte aligned so the graph can be read straight out of
+the mapping as uint64 words
+*/
+
+#define PROJECT_MAGIC "TRPJ"
+#define PROJECT_VERSION 2 // 2 added channels + layout to each node, 1 files are still read and appended to
+#define PROJECT_HEADER_SIZE 16
+#define PROJECT_CHUNK_MIN 1024
+#define PROJECT_CHUNK_MAX 16384
+#define PROJECT_CHUNK_BITS 12 // a cut roughly every 4096 samples past the minimum
+
+typedef struct {
+    char tag[4];
+    uint32_t reserved;
+    uint64_t len; // payload bytes following this header
+} RecordHeader;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset; // file offset of the BLK record, 0 = empty slot
+    const int16_t* samples;
+    size_t len;
+} BlockRef;
+
+typedef struct {
+    BlockRef* slots;
+    size_t capacity;
+    size_t count;
+} BlockIndex;
+
+typedef struct {
+    uint64_t* words;
+    size_t len;
+    size_t capacity;
+} WordBuffer;
+
+static uint64_t hash_samples(const int16_t* samples, size_t len) {
+    const uint8_t* bytes = (const uint8_t*)samples;
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len * sizeof(int16_t); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool block_index_put(BlockIndex* index, BlockRef ref) {
+    if ((index->count + 1) * 2 > index->capacity) {
+        size_t new_capacity = index->capacity > 0 ? index->capacity * 2 : 256;
+        BlockRef* new_slots = calloc(new_capacity, sizeof(BlockRef));
+        if (new_slots == NULL) return false;
+
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->slots[i].offset == 0) continue;
+            size_t j = index->slots[i].hash & (new_capacity - 1);
+            while (new_slots[j].offset != 0) j = (j + 1) & (new_capacity - 1);
+            new_slots[j] = index->slots[i];
+        }
+
+        free(index->slots);
+        index->slots = new_slots;
+        index->capacity = new_capacity;
+    }
+
+    size_t j = ref.hash & (index->capacity - 1);
+    while (index->slots[j].offset != 0) j = (j + 1) & (index->capacity - 1);
+    index->slots[j] = ref;
+    index->count++;
+    return true;
+}
+
+// Returns the offset of an identical block already in the file, or 0
+static uint64_t block_index_find(const BlockIndex* index, uint64_t hash, const int16_t* samples, size_t len) {
+    if (index->capacity == 0) return 0;
+
+    size_t j = hash & (index->capacity - 1);
+    while (index->slots[j].offset != 0) {
+        const BlockRef* ref = &index->slots[j];
+        if (ref->hash == hash && ref->len == len && memcmp(ref->samples, samples, len * sizeof(int16_t)) == 0) {
+            return ref->offset;
+        }
+        j = (j + 1) & (index->capacity - 1);
+    }
+    return 0;
+}
+
+static bool words_push(WordBuffer* buf, uint64_t word) {
+    if (buf->len == buf->capacity) {
+        size_t new_capacity = buf->capacity > 0 ? buf->capacity * 2 : 64;
+        uint64_t* new_words = realloc(buf->words, new_capacity * sizeof(uint64_t));
+        if (new_words == NULL) return false;
+        buf->words = new_words;
+        buf->capacity = new_capacity;
+    }
+    buf->words[buf->len++] = word;
+    return true;
+}
+
+// The graph version of a mapped project, 0 if it isn't a project we can read
+static uint32_t project_version(const uint8_t* map) {
+    uint32_t version;
+    memcpy(&version, map + 4, sizeof(version));
+    if (memcmp(map, PROJECT_MAGIC, 4) != 0 || version == 0 || version > PROJECT_VERSION) return 0;
+    return version;
+}
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint64_t gear(int16_t sample) {
+    uint64_t x = (uint16_t)sample * 0x9E3779B97F4A7C15ULL;
+    return x ^ (x >> 29);
+}
+
+// Length of the next chunk of a run: gear hash over the samples, cut where its top bits are all zero.
+// the hash only remembers the last 64 samples so the cut points depend on nearby content, not position
+static size_t chunk_length(const int16_t* samples, size_t available) {
+    if (available <= PROJECT_CHUNK_MIN) return available;
+    size_t limit = available < PROJECT_CHUNK_MAX ? available : PROJECT_CHUNK_MAX;
+
+    uint64_t hash = 0;
+    for (size_t i = 0; i < limit; i++) {
+        hash = (hash << 1) + gear(samples[i]);
+        if (i + 1 >= PROJECT_CHUNK_MIN && (hash >> (64 - PROJECT_CHUNK_BITS)) == 0) return i + 1;
+    }
+    return limit;
+}
+
+static uint64_t new_project_id(void) {
+    static atomic_uint_fast64_t counter;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    // splitmix64 over the time, pid and a counter, it only has to tell files apart
+    uint64_t x = ((uint64_t)ts.tv_sec << 30) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 40) ^ atomic_fetch_add(&counter, 1);
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x != 0 ? x : 1;
+}
+
+static uint64_t project_id(const uint8_t* map) {
+    uint64_t id;
+    memcpy(&id, map + 8, sizeof(id));
+    return id;
+}
+
+// A remembered block is only trusted if the file still has a BLK with the same hash and length where it
+// says. the project id alone isn't enough: a copied project keeps it and then the two files drift apart
+static bool saved_block_ok(const uint8_t* map, size_t end, const SavedBlock* block) {
+    if (block->offset < PROJECT_HEADER_SIZE || block->offset + sizeof(RecordHeader) + 16 > end) return false;
+    uint64_t head[2];
+    memcpy(head, map + block->offset + sizeof(RecordHeader), sizeof(head));
+    return memcmp(map + block->offset, "BLK", 4) == 0 && head[0] == block->hash && head[1] == block->len;
+}
+
+/*
+walk the records of a mapped project file. returns the end of the last complete record (anything
+past that is a torn append and gets overwritten next save), fills in the block index if given and
+points *graph at the payload of the last GRF record
+*/
+static size_t project_scan(const uint8_t* map, size_t size, BlockIndex* index, const uint64_t** graph, size_t* graph_len) {
+    size_t pos = PROJECT_HEADER_SIZE;
+
+    while (pos + sizeof(RecordHeader) <= size) {
+        RecordHeader rec;
+        memcpy(&rec, map + pos, sizeof(rec));
+        size_t payload = pos + sizeof(RecordHeader);
+        if (rec.len > size - payload || rec.len % 8 != 0) break;
+
+        if (memcmp(rec.tag, "BLK", 4) == 0 && rec.len >= 16) {
+            const uint64_t* words = (const uint64_t*)(map + payload);
+            BlockRef ref = { words[0], pos, (const int16_t*)(words + 2), words[1] };
+            if (ref.len * sizeof(int16_t) > rec.len - 16) break;
+            if (index != NULL && !block_index_put(index, ref)) break;
+        } else if (memcmp(rec.tag, "GRF", 4) == 0) {
+            if (graph != NULL) {
+                *graph = (const uint64_t*)(map + payload);
+                *graph_len = rec.len / sizeof(uint64_t);
+            }
+        } else {
+            break;
+        }
+
+        pos = payload + rec.len;
+    }
+
+    return pos;
+}
+
+// Depth first collection of every segment reachable from root, root ends up as node 0
+static bool collect_nodes(struct sound_seg* seg, struct sound_seg*** nodes, size_t* count, size_t* capacity) {
+    for (size_t i = 0; i < *count; i++) {
+        if ((*nodes)[i] == seg) return true;
+    }
+
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+        struct sound_seg** new_nodes = realloc(*nodes, new_capacity * sizeof(struct sound_seg*));
+        if (new_nodes == NULL) return false;
+        *nodes = new_nodes;
+        *capacity = new_capacity;
+    }
+    (*nodes)[(*count)++] = seg;
+
+    for (size_t i = 0; i < seg->num_track_ptrs; i++) {
+        if (!collect_nodes(seg->track_ptrs[i], nodes, count, capacity)) return false;
+    }
+    return true;
+}
+
+static size_t node_id(struct sound_seg** nodes, size_t count, struct sound_seg* seg) {
+    for (size_t i = 0; i < count; i++) {
+        if (nodes[i] == seg) return i;
+    }
+    return 0;
+}
+
+/*
+state for one save: the mapping of what was already in the file, the block index (built the first
+time a block actually needs hashing) and the file being appended to
+*/
+typedef struct {
+    const uint8_t* map;
+    size_t end;
+    BlockIndex index;
+    bool indexed;
+    FILE* file;
+} ProjectWriter;
+
+// Find or append the BLK for len samples, puts its file offset in *offset and its hash in *hash
+static bool project_put_block(ProjectWriter* writer, const int16_t* samples, size_t len, uint64_t* offset,
+                              uint64_t* hash_out) {
+    if (!writer->indexed) {
+        if (writer->map != NULL) project_scan(writer->map, writer->end, &writer->index, NULL, NULL);
+        writer->indexed = true;
+    }
+
+    uint64_t hash = hash_samples(samples, len);
+    *hash_out = hash;
+    *offset = block_index_find(&writer->index, hash, samples, len);
+    if (*offset != 0) return true;
+
+    *offset = (uint64_t)ftell(writer->file);
+    uint64_t head[2] = { hash, len };
+    uint64_t pad = 0;
+    size_t pad_len = (8 - (len * sizeof(int16_t)) % 8) % 8;
+
+    RecordHeader rec = { "BLK", 0, sizeof(head) + len * sizeof(int16_t) + pad_len };
+    if (fwrite(&rec, sizeof(rec), 1, writer->file) != 1 || fwrite(head, sizeof(head), 1, writer->file) != 1 ||
+        fwrite(samples, sizeof(int16_t), len, writer->file) != len ||
+        fwrite(&pad, 1, pad_len, writer->file) != pad_len) return false;
+
+    BlockRef ref = { hash, *offset, samples, len };
+    return block_index_put(&writer->index, ref);
+}
+
+static bool saved_push(SavedBlocks* saved, size_t* capacity, SavedBlock block) {
+    if (saved->count == *capacity) {
+        size_t new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+        SavedBlock* new_blocks = realloc(saved->blocks, new_capacity * sizeof(SavedBlock));
+        if (new_blocks == NULL) return false;
+        saved->blocks = new_blocks;
+        *capacity = new_capacity;
+    }
+    saved->blocks[saved->count++] = block;
+    return true;
+}
+
+/*
+write seg's blocks, reusing what it remembers from the last save to this project and chunking only the
+gaps edits left. a gap's last chunk stops where the next remembered block starts so that block (and
+everything after it) can be picked up as is. fills *out with where every block ended up
+*/
+static bool project_save_samples(ProjectWriter* writer, uint64_t id, struct sound_seg* seg, WordBuffer* graph,
+                                 SavedBlocks* out) {
+    bool planar = seg->track.layout == TR_LAYOUT_PLANAR;
+    size_t runs = planar ? seg->track.channels : 1;
+    size_t run_len = planar ? seg->track.length : seg->track.length * seg->track.channels;
+    const SavedBlocks* saved = &seg->saved;
+    size_t num_saved = saved->project_id == id && writer->map != NULL ? saved->count : 0;
+    size_t out_capacity = 0;
+    size_t k = 0;
+
+    // roughly as many blocks as last time, so size for that up front rather than doubling up to it
+    if (saved->count > 0) {
+        out->blocks = malloc((saved->count + 16) * sizeof(SavedBlock));
+        if (out->blocks == NULL) return false;
+        out_capacity = saved->count + 16;
+    }
+    for (size_t run = 0; run < runs; run++) {
+        const int16_t* samples = seg->track.data + run * seg->track.capacity;
+        size_t pos = 0;
+
+        while (pos < run_len) {
+            const SavedBlock* next = NULL;
+            for (; k < num_saved; k++) {
+                const SavedBlock* block = &saved->blocks[k];
+                if (block->run > run) break;
+                if (block->run < run || block->start < pos || block->offset == 0) continue;
+                if (block->start + block->len > run_len || !saved_block_ok(writer->map, writer->end, block)) continue;
+                next = block;
+                break;
+            }
+
+            SavedBlock block = { run, pos, 0, 0, 0 };
+            if (next != NULL && next->start == pos) {
+                block = *next;
+                k++;
+            } else {
+                block.len = chunk_length(samples + pos, run_len - pos);
+                if (next != NULL && next->start - pos < block.len) block.len = next->start - pos;
+                if (!project_put_block(writer, samples + pos, block.len, &block.offset, &block.hash)) return false;
+            }
+
+            if (!words_push(graph, block.offset) || !saved_push(out, &out_capacity, block)) return false;
+            pos += block.len;
+        }
+    }
+    return true;
+}
+
+// Save root and everything linked off it to path, appending to the project if it already exists
+bool tr_project_save(const char* path, struct sound_seg* root) {
+    if (path == NULL || root == NULL) return false;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("Failed to open project");
+        return false;
+    }
+
+    bool ok = false;
+    struct stat st;
+    uint8_t* map = NULL;
+    size_t map_size = 0;
+    ProjectWriter writer = {0};
+    WordBuffer graph = {0};
+    struct sound_seg** nodes = NULL;
+    SavedBlocks* placed = NULL;
+    size_t num_nodes = 0, nodes_capacity = 0;
+    size_t end = PROJECT_HEADER_SIZE;
+    uint64_t id = 0;
+    uint32_t version = PROJECT_VERSION;
+
+    if (fstat(fd, &st) != 0) goto done;
+
+    if (st.st_size > 0) {
+        map_size = (size_t)st.st_size;
+        map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+            goto done;
+        }
+        // don't clobber something that isn't one of ours
+        if (map_size < PROJECT_HEADER_SIZE || (version = project_version(map)) == 0) goto done;
+        end = project_scan(map, map_size, NULL, NULL, NULL);
+        id = project_id(map);
+    }
+
+    // drop any torn tail from an interrupted save so the new records follow on cleanly
+    if (ftruncate(fd, (off_t)end) != 0) goto done;
+
+    if (map == NULL) {
+        uint8_t header[PROJECT_HEADER_SIZE] = {0};
+        id = new_project_id();
+        memcpy(header, PROJECT_MAGIC, 4);
+        memcpy(header + 4, &version, sizeof(version));
+        memcpy(header + 8, &id, sizeof(id));
+        if (pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) goto done;
+    } else if (id == 0) {
+        // written before projects had ids: give it one, nothing anyone remembers can point into it yet
+        id = new_project_id();
+        if (pwrite(fd, &id, sizeof(id), 8) != (ssize_t)sizeof(id)) goto done;
+    }
+
+    writer.file = fdopen(fd, "r+b");
+    if (writer.file == NULL) goto done;
+    fd = -1;
+    writer.map = map;
+    writer.end = end;
+    if (fseek(writer.file, (long)end, SEEK_SET) != 0) goto done;
+
+    if (!collect_nodes(root, &nodes, &num_nodes, &nodes_capacity)) goto done;
+    placed = calloc(num_nodes, sizeof(SavedBlocks));
+    if (placed == NULL || !words_push(&graph, num_nodes)) goto done;
+
+    for (size_t n = 0; n < num_nodes; n++) {
+        struct sound_seg* seg = nodes[n];
+
+        // a version 1 project only has mono nodes, its snapshots keep to that so older readers still work
+        if (version == 1 && seg->track.channels != 1) {
+            fprintf(stderr, "Project %s is version 1 and can only hold mono segments\n", path);
+            goto done;
+        }
+
+        // the block count isn't known until the samples have been chunked, it's filled in after
+        size_t blocks_at = graph.len + (version == 1 ? 1 : 3);
+        if (!words_push(&graph, seg->track.length)) goto done;
+        if (version > 1 && (!words_push(&graph, seg->track.channels) || !words_push(&graph, seg->track.layout))) goto done;
+        if (!words_push(&graph, 0) || !words_push(&graph, seg->num_effects) ||
+            !words_push(&graph, seg->num_track_ptrs)) goto done;
+
+        if (!project_save_samples(&writer, id, seg, &graph, &placed[n])) goto done;
+        graph.words[blocks_at] = placed[n].count;
+
+        for (size_t e = 0; e < seg->num_effects; e++) {
+            const Effect* fx = &seg->effects[e];
+            if (!words_push(&graph, (uint64_t)fx->type) || !words_push(&graph, fx->pos) || !words_push(&graph, fx->len) ||
+                !words_push(&graph, double_bits(fx->a)) || !words_push(&graph, double_bits(fx->b))) goto done;
+        }
+
+        for (size_t i = 0; i < seg->num_track_ptrs; i++) {
+            if (!words_push(&graph, node_id(nodes, num_nodes, seg->track_ptrs[i]))) goto done;
+        }
+    }
+
+    RecordHeader rec = { "GRF", 0, graph.len * sizeof(uint64_t) };
+    if (fwrite(&rec, sizeof(rec), 1, writer.file) != 1 ||
+        fwrite(graph.words, sizeof(uint64_t), graph.len, writer.file) != graph.len) goto done;
+    ok = fflush(writer.file) == 0;
+
+    // only now that the GRF is down do the new block positions become what the segments remember
+    for (size_t n = 0; ok && n < num_nodes; n++) {
+        free(nodes[n]->saved.blocks);
+        nodes[n]->saved = placed[n];
+        nodes[n]->saved.project_id = id;
+        placed[n].blocks = NULL;
+    }
+
+done:
+    if (!ok) fprintf(stderr, "Failed to save project %s\n", path);
+    if (writer.file != NULL) fclose(writer.file);
+    if (fd >= 0) close(fd);
+    if (map != NULL) munmap(map, map_size);
+    for (size_t n = 0; placed != NULL && n < num_nodes; n++) free(placed[n].blocks);
+    free(placed);
+    free(writer.index.slots);
+    free(graph.words);
+    free(nodes);
+    return ok;
+}
+
+/*
+depth first over the links of a freshly loaded graph. state[n] is 0 unvisited, 1 on the current path,
+2 done. a link back onto the path is a cycle (reading would recurse forever) and a link to a node with a
+different channel count would overrun the flat buffer tr_read sizes from the root
+*/
+static bool project_links_ok(struct sound_seg** nodes, size_t count, size_t n, uint8_t* state) {
+    state[n] = 1;
+    for (size_t i = 0; i < nodes[n]->num_track_ptrs; i++) {
+        struct sound_seg* next = nodes[n]->track_ptrs[i];
+        size_t id = node_id(nodes, count, next);
+        if (next->track.channels != nodes[n]->track.channels || state[id] == 1) return false;
+        if (state[id] == 0 && !project_links_ok(nodes, count, id, state)) return false;
+    }
+    state[n] = 2;
+    return true;
+}
+
+// Rebuild the segment graph from the last snapshot in a project file, returns the root segment.
+// linked segments come back wired up through track_ptrs exactly as tr_insert left them, and are owned
+// by the root: tr_project_destroy frees the whole graph, tr_destroy would only free the root
+struct sound_seg* tr_project_load(const char* path) {
+    if (path == NULL) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open project");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < PROJECT_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t map_size = (size_t)st.st_size;
+    uint8_t* map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    struct sound_seg** nodes = NULL;
+    uint8_t* state = NULL;
+    struct sound_seg* root = NULL;
+    const uint64_t* graph = NULL;
+    size_t graph_len = 0;
+    size_t num_nodes = 0;
+
+    uint32_t version = project_version(map);
+    if (version == 0) goto done;
+    project_scan(map, map_size, NULL, &graph, &graph_len);
+    if (graph == NULL || graph_len == 0) goto done;
+
+    num_nodes = graph[0];
+    if (num_nodes == 0 || num_nodes > graph_len) goto done;
+    nodes = calloc(num_nodes, sizeof(struct sound_seg*));
+    if (nodes == NULL) goto done;
+    for (size_t n = 0; n < num_nodes; n++) {
+        nodes[n] = tr_init();
+        if (nodes[n] == NULL) goto fail;
+    }
+
+    size_t w = 1;
+    for (size_t n = 0; n < num_nodes; n++) {
+        struct sound_seg* seg = nodes[n];
+        // version 1 nodes have no channels/layout words and are mono
+        size_t node_words = version == 1 ? 4 : 6;
+        if (node_words > graph_len - w) goto fail;
+        size_t length = graph[w], channels = 1, layout = TR_LAYOUT_INTERLEAVED;
+        if (version > 1) {
+            channels = graph[w + 1];
+            layout = graph[w + 2];
+        }
+        size_t num_blocks = graph[w + node_words - 3], num_effects = graph[w + node_words - 2];
+        size_t num_links = graph[w + node_words - 1];
+        w += node_words;
+
+        if (channels == 0 || channels > UINT16_MAX || layout > TR_LAYOUT_PLANAR) goto fail;
+        // every sample has to come out of the file, which also keeps length * channels from overflowing
+        if (length > map_size / sizeof(int16_t) / channels) goto fail;
+        // divide rather than multiply so a garbage count can't wrap past the check
+        if (num_links > 2 || num_blocks > graph_len - w || num_effects > (graph_len - w - num_blocks) / 5 ||
+            num_links > graph_len - w - num_blocks - num_effects * 5) goto fail;
+
+        size_t capacity = length > 0 ? length : 8;
+        int16_t* data = realloc(seg->track.data, capacity * channels * sizeof(int16_t));
+        if (data == NULL) goto fail;
+        seg->track.data = data;
+        seg->track.capacity = capacity;
+        seg->track.channels = (uint16_t)channels;
+        seg->track.layout = (enum tr_layout)layout;
+
+        // same runs as the save side: one per channel when planar, a single one otherwise
+        size_t run_len = layout == TR_LAYOUT_PLANAR ? length : length * channels;
+        size_t total = length * channels;
+        size_t filled = 0;
+        size_t saved_capacity = 0;
+        seg->saved.project_id = project_id(map);
+        for (size_t b = 0; b < num_blocks; b++) {
+            uint64_t offset = graph[w++];
+            if (offset < PROJECT_HEADER_SIZE || offset % 8 != 0 || offset > map_size ||
+                map_size - offset < sizeof(RecordHeader) + 16) goto fail;
+
+            // the offset has to land on a whole BLK record, not just anywhere in the file
+            RecordHeader rec;
+            memcpy(&rec, map + offset, sizeof(rec));
+            const uint64_t* head = (const uint64_t*)(map + offset + sizeof(RecordHeader));
+            size_t len = head[1];
+            if (memcmp(rec.tag, "BLK", 4) != 0 || rec.len < 16 || rec.len > map_size - offset - sizeof(RecordHeader) ||
+                len > (rec.len - 16) / sizeof(int16_t)) goto fail;
+            if (run_len == 0 || filled >= total || len == 0 || len > run_len - filled % run_len) goto fail;
+
+            memcpy(seg->track.data + (filled / run_len) * capacity + filled % run_len, head + 2, len * sizeof(int16_t));
+            SavedBlock block = { filled / run_len, filled % run_len, len, offset, head[0] };
+            if (!saved_push(&seg->saved, &saved_capacity, block)) goto fail;
+            filled += len;
+        }
+        if (filled != total) goto fail;
+        seg->track.length = length;
+
+        for (size_t e = 0; e < num_effects; e++) {
+            if (graph[w] > TR_EFFECT_DC_OFFSET) goto fail;
+            if (!tr_add_effect(seg, (enum tr_effect_type)graph[w], graph[w + 1], graph[w + 2],
+                               bits_double(graph[w + 3]), bits_double(graph[w + 4]))) goto fail;
+            w += 5;
+        }
+
+        for (size_t i = 0; i < num_links; i++) {
+            size_t id = graph[w++];
+            if (id >= num_nodes) goto fail;
+            seg->track_ptrs[seg->num_track_ptrs++] = nodes[id];
+        }
+    }
+
+    // links are only known to be sane once every node is in: same channels on both ends, and no cycles
+    state = calloc(num_nodes, sizeof(uint8_t));
+    if (state == NULL || !project_links_ok(nodes, num_nodes, 0, state)) goto fail;
+    for (size_t n = 1; n < num_nodes; n++) {
+        if (state[n] == 0 && !project_links_ok(nodes, num_nodes, n, state)) goto fail;
+    }
+
+    root = nodes[0];
+    goto done;
+
+fail:
+    for (size_t n = 0; n < num_nodes; n++) tr_destroy(nodes[n]);
+
+done:
+    free(state);
+    free(nodes);
+    munmap(map, map_size);
+    return root;
+}
+
+
 
                     
 
@@ -523,4 +2164,21 @@ void tr_insert(struct sound_seg* src_track,
 
 
 // expected [-18 -18 -18 -18  -1   2 -18 -18  13 -18 -18 -18 -18 -18 -18 -18 -18   6 -13 -18 -18 -18  -1   2 -18 -18  13 -18  10 -18 -18 -18 -18 -18 -18 -18], 
-// actual   [-18 -18 -18 -18 -11 -18 -18 -18 -18 -18 -18 -18 -18 -18 -18 -18 -18   6 -13 -18 -18 -18  -1   2 -18 -18  13 -18  10 -18 -18 -18 -18 -18 -18 -18]
\ No newline at end of file
+// actual   [-18 -18 -18 -18 -11 -18 -18 -18 -18 -18 -18 -18 -18 -18 -18 -18 -18   6 -13 -18 -18 -18  -1   2 -18 -18  13 -18  10 -18 -18 -18 -18 -18 -18 -18]
+
+// Free root and every segment reachable from it, each exactly once (links can share a segment)
+void tr_project_destroy(struct sound_seg* root) {
+    if (root == NULL) return;
+
+    struct sound_seg** nodes = NULL;
+    size_t count = 0, capacity = 0;
+    if (!collect_nodes(root, &nodes, &count, &capacity)) {
+        // out of memory walking the graph, the root at least doesn't leak
+        free(nodes);
+        tr_destroy(root);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) tr_destroy(nodes[i]);
+    free(nodes);
+}
@@ -6,22 +6,99 @@
 #include <stddef.h>
 #include <stdbool.h>
 
-struct sound_seg {
-    int16_t* data;
-    size_t length;
-    size_t capacity;
+// the real layout lives in sound_seg.c (linked Track pieces + effect nodes)
+struct sound_seg;
+
+// how a multi-channel segment stores its samples. tr_read/tr_write always take interleaved frames,
+// this only changes the in-memory layout (and so which operations are cheap)
+enum tr_layout {
+    TR_LAYOUT_INTERLEAVED, // L R L R ..., matches WAV so loading/saving is a straight copy
+    TR_LAYOUT_PLANAR       // each channel contiguous, see tr_channel_data, for analysis
+};
+
+// non-destructive effects which are attached to a segment and only evaluated when
+// samples are pulled out (tr_read / wav_save_seg). pos/len are in the segment's own frames
+enum tr_effect_type {
+    TR_EFFECT_GAIN,      // multiply by a
+    TR_EFFECT_FADE,      // gain ramps linearly from a to b across the range
+    TR_EFFECT_REVERSE,   // play the range backwards (a, b unused)
+    TR_EFFECT_DC_OFFSET  // add a to every sample
+};
+
+// one ad occurrence found by tr_identify_matches
+struct tr_match {
+    size_t start;
+    size_t end;   // inclusive, same as the pairs in tr_identify's string
+    double score; // cross correlation normalised by the ad's autocorrelation
+};
+
+enum tr_overlap_policy {
+    TR_OVERLAP_SKIP,  // resume scanning after a match (what tr_identify does)
+    TR_OVERLAP_ALLOW  // report every position over the threshold
+};
+
+struct tr_identify_opts {
+    double threshold; // tr_identify uses 0.95
+    size_t top_k;     // keep only the k best scores, 0 = keep every match
+    enum tr_overlap_policy overlap;
+};
+
+// per-operation counters for tr_stats_get, only collected when built with -DTR_STATS
+enum tr_stat_op {
+    TR_OP_READ,
+    TR_OP_WRITE,
+    TR_OP_DELETE_RANGE,
+    TR_OP_INSERT,
+    TR_OP_IDENTIFY,
+    TR_OP_FLATTEN, // one per segment copied out of a linked chain
+    TR_OP_COUNT
+};
+
+#define TR_STATS_BUCKETS 32
+
+struct tr_op_stats {
+    uint64_t calls;
+    uint64_t bytes_copied; // memcpy/memmove traffic
+    uint64_t allocs;       // malloc/realloc calls
+    uint64_t total_ns;
+    uint64_t latency_hist[TR_STATS_BUCKETS]; // bucket b counts calls taking [2^b, 2^(b+1)) ns
+};
+
+struct tr_stats {
+    struct tr_op_stats ops[TR_OP_COUNT];
+    uint64_t max_chain_depth; // deepest linked segment chain flattened
 };
 
+// lengths and positions are in frames (one sample per channel), mono segments are one sample per frame
 struct sound_seg* tr_init();
+struct sound_seg* tr_init_channels(uint16_t channels, enum tr_layout layout);
 void wav_load(const char* filename, int16_t* dest);
 void wav_save(const char* filename, const int16_t* src, size_t len);
+void wav_save_seg(const char* filename, struct sound_seg* seg);
+struct sound_seg** wav_load_batch(const char* const* paths, size_t count, size_t num_threads);
 void tr_destroy(struct sound_seg* obj);
 size_t tr_length(struct sound_seg* seg);
+uint16_t tr_channels(struct sound_seg* seg);
+enum tr_layout tr_get_layout(struct sound_seg* seg);
+bool tr_set_layout(struct sound_seg* seg, enum tr_layout layout);
+const int16_t* tr_channel_data(struct sound_seg* seg, uint16_t channel);
 void tr_read(struct sound_seg* track, int16_t* dest, size_t pos, size_t len);
 void tr_write(struct sound_seg* track, int16_t* src, size_t pos, size_t len);
 bool tr_delete_range(struct sound_seg* track, size_t pos, size_t len);
 void tr_insert(struct sound_seg* dest, struct sound_seg* src, size_t destpos, size_t srcpos, size_t len);
 double cross_correlation(const int16_t* data1, const int16_t* data2, size_t len);
 char* tr_identify(struct sound_seg* target, struct sound_seg* ad);
+size_t tr_identify_matches(struct sound_seg* target, struct sound_seg* ad, const struct tr_identify_opts* opts,
+                           struct tr_match* out, size_t out_cap);
+struct tr_match* tr_identify_matches_alloc(struct sound_seg* target, struct sound_seg* ad,
+                                           const struct tr_identify_opts* opts, size_t* count);
+bool tr_add_effect(struct sound_seg* seg, enum tr_effect_type type, size_t pos, size_t len, double a, double b);
+void tr_clear_effects(struct sound_seg* seg);
+bool tr_project_save(const char* path, struct sound_seg* root);
+// the segments linked off a loaded root belong to it: free the lot with tr_project_destroy, not tr_destroy
+struct sound_seg* tr_project_load(const char* path);
+void tr_project_destroy(struct sound_seg* root);
+void tr_stats_get(struct tr_stats* out);
+void tr_stats_reset(void);
 
 #endif
\ No newline at end of file
@@ -1,3 +1,982 @@
+// test.c - behaviour checks for sound_seg, `make test` builds and runs them
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sound_seg.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+// Compare what tr_read gives back against an expected list of samples
+static void check_track(struct sound_seg* seg, const int16_t* expected, size_t len, int line) {
+    int16_t got[256];
+    if (tr_length(seg) != len) {
+        printf("FAIL %s:%d: length %zu, expected %zu\n", __FILE__, line, tr_length(seg), len);
+        failures++;
+        return;
+    }
+    tr_read(seg, got, 0, len);
+    for (size_t i = 0; i < len; i++) {
+        if (got[i] != expected[i]) {
+            printf("FAIL %s:%d: sample %zu is %d, expected %d\n", __FILE__, line, i, got[i], expected[i]);
+            failures++;
+            return;
+        }
+    }
+}
+
+#define CHECK_TRACK(seg, ...) do { \
+    int16_t expected_[] = { __VA_ARGS__ }; \
+    check_track((seg), expected_, sizeof(expected_) / sizeof(expected_[0]), __LINE__); \
+} while (0)
+
+static struct sound_seg* ramp_track(size_t len) {
+    struct sound_seg* seg = tr_init();
+    int16_t buf[256];
+    for (size_t i = 0; i < len; i++) buf[i] = (int16_t)i;
+    tr_write(seg, buf, 0, len);
+    return seg;
+}
+
+// ---------------- effects (user-026) ----------------
+
+static void test_effect_order(void) {
+    // nodes apply in the order they were added
+    struct sound_seg* t = ramp_track(4);
+    tr_add_effect(t, TR_EFFECT_GAIN, 0, 4, 2, 0);
+    tr_add_effect(t, TR_EFFECT_DC_OFFSET, 0, 4, 1, 0);
+    CHECK_TRACK(t, 1, 3, 5, 7);
+    tr_clear_effects(t);
+    CHECK_TRACK(t, 0, 1, 2, 3);
+
+    tr_add_effect(t, TR_EFFECT_DC_OFFSET, 0, 4, 1, 0);
+    tr_add_effect(t, TR_EFFECT_GAIN, 0, 4, 2, 0);
+    CHECK_TRACK(t, 2, 4, 6, 8);
+    tr_destroy(t);
+
+    // gain after a reverse lands on the reversed positions, gain before it travels with its samples
+    t = ramp_track(6);
+    tr_add_effect(t, TR_EFFECT_REVERSE, 0, 4, 0, 0);
+    tr_add_effect(t, TR_EFFECT_GAIN, 0, 2, 10, 0);
+    CHECK_TRACK(t, 30, 20, 1, 0, 4, 5);
+    tr_destroy(t);
+
+    t = ramp_track(6);
+    tr_add_effect(t, TR_EFFECT_GAIN, 0, 2, 10, 0);
+    tr_add_effect(t, TR_EFFECT_REVERSE, 0, 4, 0, 0);
+    CHECK_TRACK(t, 3, 2, 10, 0, 4, 5);
+    tr_destroy(t);
+}
+
+static void test_effect_fade_and_clamp(void) {
+    struct sound_seg* t = tr_init();
+    int16_t flat[5] = { 100, 100, 100, 100, 100 };
+    tr_write(t, flat, 0, 5);
+    tr_add_effect(t, TR_EFFECT_FADE, 0, 5, 0.0, 1.0);
+    CHECK_TRACK(t, 0, 25, 50, 75, 100);
+
+    tr_add_effect(t, TR_EFFECT_GAIN, 0, 5, 1000, 0);
+    tr_add_effect(t, TR_EFFECT_DC_OFFSET, 0, 1, -40000, 0);
+    CHECK_TRACK(t, -32768, 25000, 32767, 32767, 32767);
+    tr_destroy(t);
+}
+
+static void test_effect_fade_cut(void) {
+    // cutting the tail off a fade leaves the rest of the ramp where it was
+    struct sound_seg* t = ramp_track(10);
+    int16_t samples[10];
+    for (size_t i = 0; i < 10; i++) samples[i] = 900;
+    tr_write(t, samples, 0, 10);
+    tr_add_effect(t, TR_EFFECT_FADE, 0, 10, 0, 1);
+    CHECK_TRACK(t, 0, 100, 200, 300, 400, 500, 600, 700, 800, 900);
+    CHECK(tr_delete_range(t, 8, 2));
+    CHECK_TRACK(t, 0, 100, 200, 300, 400, 500, 600, 700);
+    tr_destroy(t);
+
+    // and one through the middle splits it in two
+    t = ramp_track(10);
+    tr_write(t, samples, 0, 10);
+    tr_add_effect(t, TR_EFFECT_FADE, 0, 10, 0, 1);
+    CHECK(tr_delete_range(t, 4, 2));
+    CHECK_TRACK(t, 0, 100, 200, 300, 600, 700, 800, 900);
+    tr_destroy(t);
+}
+
+static void test_effect_edits_after_reverse(void) {
+    // edits use the positions tr_read shows, even through a reverse
+    struct sound_seg* t = ramp_track(10);
+    tr_add_effect(t, TR_EFFECT_REVERSE, 0, 10, 0, 0);
+    tr_add_effect(t, TR_EFFECT_GAIN, 0, 5, 10, 0);
+    CHECK_TRACK(t, 90, 80, 70, 60, 50, 4, 3, 2, 1, 0);
+    CHECK(tr_delete_range(t, 2, 3));
+    CHECK_TRACK(t, 90, 80, 4, 3, 2, 1, 0);
+    tr_destroy(t);
+
+    // same again with the gain before the reverse, so it has to be mirrored when the reverse is baked
+    t = ramp_track(10);
+    tr_add_effect(t, TR_EFFECT_GAIN, 0, 5, 10, 0);
+    tr_add_effect(t, TR_EFFECT_REVERSE, 0, 10, 0, 0);
+    CHECK_TRACK(t, 9, 8, 7, 6, 5, 40, 30, 20, 10, 0);
+    CHECK(tr_delete_range(t, 2, 3));
+    CHECK_TRACK(t, 9, 8, 40, 30, 20, 10, 0);
+    tr_destroy(t);
+
+    // a fade straddling a partial reverse keeps every rendered value
+    t = tr_init();
+    int16_t flat[8] = { 700, 700, 700, 700, 700, 700, 700, 700 };
+    tr_write(t, flat, 0, 8);
+    tr_add_effect(t, TR_EFFECT_FADE, 0, 8, 0.0, 1.0);
+    tr_add_effect(t, TR_EFFECT_REVERSE, 2, 4, 0, 0);
+    CHECK_TRACK(t, 0, 100, 500, 400, 300, 200, 600, 700);
+    int16_t x = 1;
+    tr_write(t, &x, 7, 1);
+    CHECK_TRACK(t, 0, 100, 500, 400, 300, 200, 600, 1);
+    tr_destroy(t);
+
+    // a write through a reverse lands where it was aimed
+    t = ramp_track(6);
+    tr_add_effect(t, TR_EFFECT_REVERSE, 1, 4, 0, 0);
+    int16_t w[2] = { 77, 88 };
+    tr_write(t, w, 1, 2);
+    CHECK_TRACK(t, 0, 77, 88, 2, 1, 5);
+    tr_destroy(t);
+}
+
+// random gain/dc/fade/reverse stacks: deleting a range has to remove exactly that range of the rendered output
+static void test_effect_delete_model(void) {
+    srand(26);
+    for (int round = 0; round < 200; round++) {
+        size_t len = 8 + (size_t)(rand() % 40);
+        struct sound_seg* t = ramp_track(len);
+
+        int effects = 1 + rand() % 5;
+        for (int e = 0; e < effects; e++) {
+            size_t pos = (size_t)rand() % len;
+            size_t span = 1 + (size_t)rand() % (len - pos);
+            int kind = rand() % 4;
+            if (kind == 0) tr_add_effect(t, TR_EFFECT_REVERSE, pos, span, 0, 0);
+            else if (kind == 1) tr_add_effect(t, TR_EFFECT_GAIN, pos, span, 2 + rand() % 3, 0);
+            else if (kind == 2) tr_add_effect(t, TR_EFFECT_DC_OFFSET, pos, span, 100 * (1 + rand() % 3), 0);
+            else tr_add_effect(t, TR_EFFECT_FADE, pos, span, (rand() % 5) / 2.0, (rand() % 5) / 2.0);
+        }
+
+        int16_t before[64], after[64];
+        tr_read(t, before, 0, len);
+
+        size_t pos = (size_t)rand() % len;
+        size_t cut = 1 + (size_t)rand() % (len - pos);
+        CHECK(tr_delete_range(t, pos, cut));
+        CHECK(tr_length(t) == len - cut);
+        tr_read(t, after, 0, len - cut);
+
+        memmove(before + pos, before + pos + cut, (len - pos - cut) * sizeof(int16_t));
+        CHECK(memcmp(before, after, (len - cut) * sizeof(int16_t)) == 0);
+        tr_destroy(t);
+    }
+}
+
+static void test_identify_sees_effects(void) {
+    struct sound_seg* target = tr_init();
+    struct sound_seg* ad = tr_init();
+    int16_t ad_data[3] = { 100, 200, 300 };
+    int16_t target_data[10] = { 0, 100, 200, 300, 0, 0, 100, 200, 300, 0 };
+    tr_write(ad, ad_data, 0, 3);
+    tr_write(target, target_data, 0, 10);
+
+    char* result = tr_identify(target, ad);
+    CHECK(strcmp(result, "1,3\n6,8") == 0);
+    free(result);
+
+    // silenced target: nothing left to find
+    tr_add_effect(target, TR_EFFECT_GAIN, 0, 10, 0, 0);
+    result = tr_identify(target, ad);
+    CHECK(strcmp(result, "") == 0);
+    free(result);
+    tr_clear_effects(target);
+
+    // only the second copy muted, and a reversed ad still matches a reversed copy
+    tr_add_effect(target, TR_EFFECT_GAIN, 6, 3, 0, 0);
+    result = tr_identify(target, ad);
+    CHECK(strcmp(result, "1,3") == 0);
+    free(result);
+
+    tr_add_effect(target, TR_EFFECT_REVERSE, 1, 3, 0, 0);
+    tr_add_effect(ad, TR_EFFECT_REVERSE, 0, 3, 0, 0);
+    result = tr_identify(target, ad);
+    CHECK(strcmp(result, "1,3") == 0);
+    free(result);
+
+    tr_destroy(target);
+    tr_destroy(ad);
+}
+
+// ---------------- identify matches (user-029) ----------------
+
+static struct sound_seg* track_of(const int16_t* samples, size_t len) {
+    struct sound_seg* seg = tr_init();
+    tr_write(seg, (int16_t*)samples, 0, len);
+    return seg;
+}
+
+static void test_identify_top_k(void) {
+    // three copies of the ad at 1x, 2x and 1.5x, which is what they score. it alternates sign so the
+    // positions next to a copy score low
+    int16_t ad_data[3] = { 300, -300, 300 };
+    int16_t target_data[24] = { 0, 0, 300, -300, 300, 0, 0, 0, 0, 0, 600, -600, 600, 0, 0, 0, 0, 0, 0, 0, 450, -450, 450, 0 };
+    struct sound_seg* ad = track_of(ad_data, 3);
+    struct sound_seg* target = track_of(target_data, 24);
+
+    struct tr_match out[4];
+    struct tr_identify_opts opts = { 0.95, 0, TR_OVERLAP_SKIP };
+    CHECK(tr_identify_matches(target, ad, &opts, out, 4) == 3);
+    CHECK(out[0].start == 2 && out[0].end == 4 && out[1].start == 10 && out[2].start == 20);
+    CHECK(out[0].score > 0.99 && out[0].score < 1.01 && out[1].score > 1.99 && out[2].score > 1.49);
+
+    // best two, still handed back in track order
+    opts.top_k = 2;
+    CHECK(tr_identify_matches(target, ad, &opts, out, 4) == 2);
+    CHECK(out[0].start == 10 && out[1].start == 20);
+
+    opts.top_k = 1;
+    CHECK(tr_identify_matches(target, ad, &opts, out, 4) == 1);
+    CHECK(out[0].start == 10);
+
+    // k bigger than what's there reports what's there
+    opts.top_k = 10;
+    CHECK(tr_identify_matches(target, ad, &opts, out, 4) == 3);
+
+    // out smaller than k: the count says how much room was needed, out holds the best that fit
+    opts.top_k = 3;
+    CHECK(tr_identify_matches(target, ad, &opts, out, 1) == 3);
+    CHECK(out[0].start == 10);
+
+    // raising the threshold drops the 1x copy
+    opts.top_k = 0;
+    opts.threshold = 1.2;
+    CHECK(tr_identify_matches(target, ad, &opts, out, 4) == 2);
+    CHECK(out[0].start == 10 && out[1].start == 20);
+
+    tr_destroy(target);
+    tr_destroy(ad);
+}
+
+static void test_identify_overlap(void) {
+    int16_t ones[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+    struct sound_seg* ad = track_of(ones, 4);
+    struct sound_seg* target = track_of(ones, 8);
+
+    // skipping resumes after each match, allowing reports every position
+    struct tr_match out[8];
+    struct tr_identify_opts opts = { 0.95, 0, TR_OVERLAP_SKIP };
+    CHECK(tr_identify_matches(target, ad, &opts, out, 8) == 2);
+    CHECK(out[0].start == 0 && out[0].end == 3 && out[1].start == 4 && out[1].end == 7);
+
+    opts.overlap = TR_OVERLAP_ALLOW;
+    CHECK(tr_identify_matches(target, ad, &opts, out, 8) == 5);
+    for (size_t m = 0; m < 5; m++) CHECK(out[m].start == m && out[m].end == m + 3);
+
+    // like snprintf: the total comes back even when out is short or missing
+    CHECK(tr_identify_matches(target, ad, &opts, out, 2) == 5);
+    CHECK(out[0].start == 0 && out[1].start == 1);
+    CHECK(tr_identify_matches(target, ad, &opts, NULL, 0) == 5);
+
+    size_t count = 0;
+    struct tr_match* all = tr_identify_matches_alloc(target, ad, &opts, &count);
+    CHECK(all != NULL && count == 5 && all[4].start == 4);
+    free(all);
+
+    // NULL opts is the tr_identify behaviour
+    all = tr_identify_matches_alloc(target, ad, NULL, &count);
+    CHECK(count == 2);
+    free(all);
+
+    // an ad longer than the target can't match
+    CHECK(tr_identify_matches(ad, target, &opts, out, 8) == 0);
+
+    tr_destroy(target);
+    tr_destroy(ad);
+}
+
+// ---------------- batch WAV loading (user-027) ----------------
+
+static char scratch_dir[] = "/tmp/sound_seg_test_XXXXXX";
+
+static void scratch_path(char* path, size_t size, const char* name) {
+    snprintf(path, size, "%s/%s", scratch_dir, name);
+}
+
+static void put_le(FILE* f, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) fputc((value >> (8 * i)) & 0xff, f);
+}
+
+// Hand-rolled WAV so the loader can be fed headers wav_save would never write. sub_format is only
+// written for format 0xFFFE (extensible), as the first two bytes of the usual sub format GUID
+static void write_wav(const char* path, uint16_t format, uint16_t sub_format, uint16_t channels, uint16_t bits,
+                      const int16_t* samples, size_t count, size_t junk_before, size_t junk_after) {
+    static const uint8_t guid_tail[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+                                           0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+    FILE* f = fopen(path, "wb");
+    fwrite("RIFF", 1, 4, f);
+    put_le(f, 0, 4); // nothing we load looks at the RIFF size
+    fwrite("WAVE", 1, 4, f);
+
+    fwrite("fmt ", 1, 4, f);
+    put_le(f, format == 0xFFFE ? 40 : 16, 4);
+    put_le(f, format, 2);
+    put_le(f, channels, 2);
+    put_le(f, 8000, 4);
+    put_le(f, 8000 * channels * bits / 8, 4);
+    put_le(f, channels * bits / 8, 2);
+    put_le(f, bits, 2);
+    if (format == 0xFFFE) {
+        put_le(f, 22, 2);   // cbSize
+        put_le(f, bits, 2); // valid bits
+        put_le(f, 0x3f, 4); // 5.1 channel mask
+        put_le(f, sub_format, 2);
+        fwrite(guid_tail, 1, sizeof(guid_tail), f);
+    }
+
+    if (junk_before > 0) {
+        fwrite("junk", 1, 4, f);
+        put_le(f, (uint32_t)junk_before, 4);
+        for (size_t i = 0; i < junk_before + (junk_before & 1); i++) fputc(0x55, f);
+    }
+
+    fwrite("data", 1, 4, f);
+    put_le(f, (uint32_t)(count * sizeof(int16_t)), 4);
+    fwrite(samples, sizeof(int16_t), count, f);
+
+    if (junk_after > 0) {
+        fwrite("LIST", 1, 4, f);
+        put_le(f, (uint32_t)junk_after, 4);
+        for (size_t i = 0; i < junk_after; i++) fputc(0x7f, f);
+    }
+    fclose(f);
+}
+
+static void test_batch_load(void) {
+    int16_t samples[10] = { 1, -2, 3, -4, 5, -6, 7, -8, 9, -10 };
+    static const char* names[] = { "plain.wav", "trailing_list.wav", "eight_bit.wav", "float.wav", "late_data.wav",
+                                   "stereo.wav", "odd_chunk.wav", "missing.wav", "extensible_6ch.wav",
+                                   "extensible_float.wav", "very_late_data.wav" };
+    enum { NUM_FILES = sizeof(names) / sizeof(names[0]) };
+    char paths[NUM_FILES][256];
+    const char* batch[NUM_FILES + 1];
+    for (size_t i = 0; i < NUM_FILES; i++) {
+        scratch_path(paths[i], sizeof(paths[i]), names[i]);
+        batch[i] = paths[i];
+    }
+    batch[NUM_FILES] = paths[0]; // the same file twice is just two loads
+
+    wav_save(paths[0], samples, 10);
+    int16_t surround[12] = { 1, 2, 3, 4, 5, 6, -1, -2, -3, -4, -5, -6 };
+    write_wav(paths[1], 1, 0, 1, 16, samples, 10, 0, 12);
+    write_wav(paths[2], 1, 0, 1, 8, samples, 10, 0, 0);
+    write_wav(paths[3], 3, 0, 1, 32, samples, 10, 0, 0);
+    write_wav(paths[4], 1, 0, 1, 16, samples, 10, 5000, 0);
+    write_wav(paths[5], 1, 0, 2, 16, samples, 10, 0, 0);
+    write_wav(paths[6], 1, 0, 1, 16, samples, 10, 7, 0);
+    write_wav(paths[8], 0xFFFE, 1, 6, 16, surround, 12, 0, 0);
+    write_wav(paths[9], 0xFFFE, 3, 6, 32, surround, 12, 0, 0);
+    write_wav(paths[10], 1, 0, 1, 16, samples, 10, 1 << 20, 0);
+
+    struct sound_seg** segs = wav_load_batch(batch, NUM_FILES + 1, 3);
+    CHECK(segs != NULL);
+    if (segs == NULL) return;
+
+    CHECK(segs[0] != NULL);
+    if (segs[0]) CHECK_TRACK(segs[0], 1, -2, 3, -4, 5, -6, 7, -8, 9, -10);
+    CHECK(segs[1] != NULL); // the LIST chunk after the audio isn't samples
+    if (segs[1]) CHECK_TRACK(segs[1], 1, -2, 3, -4, 5, -6, 7, -8, 9, -10);
+    CHECK(segs[2] == NULL);
+    CHECK(segs[3] == NULL);
+    CHECK(segs[4] != NULL); // big metadata chunks before the audio are just skipped
+    if (segs[4]) CHECK_TRACK(segs[4], 1, -2, 3, -4, 5, -6, 7, -8, 9, -10);
+    CHECK(segs[5] != NULL && tr_channels(segs[5]) == 2 && tr_length(segs[5]) == 5);
+    if (segs[5]) {
+        int16_t got[10];
+        tr_read(segs[5], got, 0, 5);
+        CHECK(memcmp(got, samples, sizeof(samples)) == 0);
+    }
+    CHECK(segs[6] != NULL); // odd sized chunks are padded to an even length
+    if (segs[6]) CHECK_TRACK(segs[6], 1, -2, 3, -4, 5, -6, 7, -8, 9, -10);
+    CHECK(segs[7] == NULL);
+    CHECK(segs[8] != NULL && tr_channels(segs[8]) == 6 && tr_length(segs[8]) == 2);
+    if (segs[8]) {
+        int16_t got[12];
+        tr_read(segs[8], got, 0, 2);
+        CHECK(memcmp(got, surround, sizeof(surround)) == 0);
+    }
+    CHECK(segs[9] == NULL); // extensible, but the sub format is float
+    CHECK(segs[10] != NULL);
+    if (segs[10]) CHECK_TRACK(segs[10], 1, -2, 3, -4, 5, -6, 7, -8, 9, -10);
+    CHECK(segs[11] != NULL && tr_length(segs[11]) == 10);
+
+    for (size_t i = 0; i <= NUM_FILES; i++) tr_destroy(segs[i]);
+    free(segs);
+    for (size_t i = 0; i < NUM_FILES; i++) remove(paths[i]);
+}
+
+// ---------------- project files (user-028) ----------------
+
+static size_t file_size(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+static void fill_noise(int16_t* buf, size_t len, unsigned seed) {
+    uint32_t x = seed * 2654435761u + 1;
+    for (size_t i = 0; i < len; i++) {
+        x = x * 1664525u + 1013904223u;
+        buf[i] = (int16_t)(x >> 16);
+    }
+}
+
+// seg has to read back exactly as model
+static bool same_samples(struct sound_seg* seg, const int16_t* model, size_t frames) {
+    size_t samples = frames * tr_channels(seg);
+    int16_t* got = malloc(samples * sizeof(int16_t) + 1);
+    tr_read(seg, got, 0, frames);
+    bool same = tr_length(seg) == frames && memcmp(got, model, samples * sizeof(int16_t)) == 0;
+    free(got);
+    return same;
+}
+
+static void test_project_round_trip(void) {
+    char path[256];
+    scratch_path(path, sizeof(path), "round_trip.trp");
+
+    enum { LEN = 50000 };
+    int16_t* samples = malloc(2 * LEN * sizeof(int16_t));
+    fill_noise(samples, 2 * LEN, 28);
+
+    struct sound_seg* mono = tr_init();
+    tr_write(mono, samples, 0, LEN);
+    tr_add_effect(mono, TR_EFFECT_GAIN, 10, 100, 0.5, 0);
+    tr_add_effect(mono, TR_EFFECT_FADE, 200, 300, 1, 0);
+    int16_t rendered[LEN];
+    tr_read(mono, rendered, 0, LEN);
+
+    CHECK(tr_project_save(path, mono));
+    struct sound_seg* loaded = tr_project_load(path);
+    CHECK(loaded != NULL && same_samples(loaded, rendered, LEN));
+    tr_destroy(loaded);
+
+    // planar stereo goes through the same file as another snapshot
+    struct sound_seg* stereo = tr_init_channels(2, TR_LAYOUT_PLANAR);
+    tr_write(stereo, samples, 0, LEN);
+    CHECK(tr_project_save(path, stereo));
+    loaded = tr_project_load(path);
+    CHECK(loaded != NULL && tr_channels(loaded) == 2 && tr_get_layout(loaded) == TR_LAYOUT_PLANAR);
+    if (loaded) CHECK(same_samples(loaded, samples, LEN));
+    tr_destroy(loaded);
+
+    CHECK(tr_project_load(scratch_dir) == NULL);
+    remove(path);
+    tr_destroy(stereo);
+    tr_destroy(mono);
+    free(samples);
+}
+
+static void test_project_torn_tail(void) {
+    char path[256];
+    scratch_path(path, sizeof(path), "torn.trp");
+
+    int16_t samples[6000];
+    fill_noise(samples, 6000, 1);
+    struct sound_seg* seg = tr_init();
+    tr_write(seg, samples, 0, 6000);
+    CHECK(tr_project_save(path, seg));
+    size_t good_size = file_size(path);
+
+    // an append that died half way through a record
+    FILE* f = fopen(path, "ab");
+    fwrite("BLK\0\0\0\0\0\xff\x00\x00\x00\x00\x00\x00\x00garbage", 1, 23, f);
+    fclose(f);
+
+    struct sound_seg* loaded = tr_project_load(path);
+    CHECK(loaded != NULL && same_samples(loaded, samples, 6000));
+    tr_destroy(loaded);
+
+    // the next save cuts the torn record off and carries on from the last good one
+    tr_delete_range(seg, 0, 1000);
+    CHECK(tr_project_save(path, seg));
+    CHECK(file_size(path) > good_size);
+    loaded = tr_project_load(path);
+    CHECK(loaded != NULL && same_samples(loaded, samples + 1000, 5000));
+    tr_destroy(loaded);
+
+    remove(path);
+    tr_destroy(seg);
+}
+
+static void test_project_incremental(void) {
+    char path[256];
+    scratch_path(path, sizeof(path), "incremental.trp");
+
+    enum { LEN = 400000 };
+    int16_t* model = malloc(LEN * sizeof(int16_t));
+    fill_noise(model, LEN, 7);
+    struct sound_seg* seg = tr_init();
+    tr_write(seg, model, 0, LEN);
+
+    CHECK(tr_project_save(path, seg));
+    size_t size = file_size(path);
+
+    // nothing changed: just a new graph
+    CHECK(tr_project_save(path, seg));
+    CHECK(file_size(path) - size < 2048);
+    size = file_size(path);
+
+    // a one sample delete near the front only rewrites the chunk around it, not everything after
+    CHECK(tr_delete_range(seg, 100, 1));
+    CHECK(tr_project_save(path, seg));
+    CHECK(file_size(path) - size < 40000);
+    size = file_size(path);
+    memmove(model + 100, model + 101, (LEN - 101) * sizeof(int16_t));
+    size_t len = LEN - 1;
+
+    // a fresh segment with the same samples (nothing remembered) still dedups against the file
+    struct sound_seg* copy = tr_init();
+    tr_write(copy, model, 0, len);
+    CHECK(tr_project_save(path, copy));
+    CHECK(file_size(path) - size < 2048);
+    tr_destroy(copy);
+
+    // random writes and deletes, saving and reloading in between: whatever is remembered has to stay right
+    srand(28);
+    for (int round = 0; round < 30; round++) {
+        size_t pos = (size_t)rand() % (len - 500);
+        size_t span = 1 + (size_t)rand() % 400;
+        if (rand() % 2) {
+            int16_t edit[400];
+            fill_noise(edit, span, (unsigned)round + 100);
+            tr_write(seg, edit, pos, span);
+            memcpy(model + pos, edit, span * sizeof(int16_t));
+        } else {
+            CHECK(tr_delete_range(seg, pos, span));
+            memmove(model + pos, model + pos + span, (len - pos - span) * sizeof(int16_t));
+            len -= span;
+        }
+
+        if (round % 3 == 0) {
+            CHECK(tr_project_save(path, seg));
+            struct sound_seg* loaded = tr_project_load(path);
+            CHECK(loaded != NULL && same_samples(loaded, model, len));
+            // carry on from the loaded copy every so often, its blocks come from the file
+            if (round % 2 == 0 && loaded != NULL) {
+                tr_destroy(seg);
+                seg = loaded;
+            } else {
+                tr_destroy(loaded);
+            }
+        }
+    }
+
+    // a second project knows nothing about the first one's offsets
+    char other[256];
+    scratch_path(other, sizeof(other), "incremental_other.trp");
+    CHECK(tr_project_save(other, seg));
+    struct sound_seg* loaded = tr_project_load(other);
+    CHECK(loaded != NULL && same_samples(loaded, model, len));
+    tr_destroy(loaded);
+
+    remove(other);
+    remove(path);
+    tr_destroy(seg);
+    free(model);
+}
+
+static void append_graph(const char* path, const uint64_t* words, size_t count) {
+    FILE* f = fopen(path, "ab");
+    uint32_t reserved = 0;
+    uint64_t len = count * sizeof(uint64_t);
+    fwrite("GRF", 1, 4, f);
+    fwrite(&reserved, sizeof(reserved), 1, f);
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(words, sizeof(uint64_t), count, f);
+    fclose(f);
+}
+
+static void copy_file(const char* from, const char* to) {
+    FILE* in = fopen(from, "rb");
+    FILE* out = fopen(to, "wb");
+    char buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, got, out);
+    fclose(in);
+    fclose(out);
+}
+
+// a copied project keeps its id, so what a segment remembers about one copy can line up with a
+// different block of the same length in the other
+static void test_project_copied_file(void) {
+    char a[256], b[256];
+    scratch_path(a, sizeof(a), "copy_a.trp");
+    scratch_path(b, sizeof(b), "copy_b.trp");
+
+    int16_t samples[500];
+    fill_noise(samples, 500, 5);
+    struct sound_seg* seg = track_of(samples, 500);
+    CHECK(tr_project_save(a, seg));
+    copy_file(a, b);
+
+    // each copy gets a different 500 sample block appended at the same offset
+    for (size_t i = 0; i < 500; i++) samples[i] = 111;
+    tr_write(seg, samples, 0, 500);
+    CHECK(tr_project_save(a, seg));
+
+    struct sound_seg* other = tr_project_load(b);
+    CHECK(other != NULL);
+    if (other == NULL) return;
+    for (size_t i = 0; i < 500; i++) samples[i] = -222;
+    tr_write(other, samples, 0, 500);
+    CHECK(tr_project_save(b, other));
+
+    // seg's remembered block sits where b has the -222 one: it must not be reused
+    CHECK(tr_project_save(b, seg));
+    struct sound_seg* loaded = tr_project_load(b);
+    int16_t got[500];
+    CHECK(loaded != NULL && tr_length(loaded) == 500);
+    if (loaded) {
+        tr_read(loaded, got, 0, 500);
+        CHECK(got[0] == 111 && got[499] == 111);
+    }
+
+    tr_project_destroy(loaded);
+    tr_project_destroy(other);
+    tr_destroy(seg);
+    remove(a);
+    remove(b);
+}
+
+// hand written graphs: node = length, channels, layout, blocks, effects, links, then the lists
+static void test_project_load_hardening(void) {
+    char path[256];
+    scratch_path(path, sizeof(path), "hardening.trp");
+
+    // ten samples make one block, the first record after the header
+    struct sound_seg* seg = ramp_track(10);
+    CHECK(tr_project_save(path, seg));
+    tr_destroy(seg);
+
+    // a block offset into the middle of the BLK record instead of its start
+    uint64_t inside_block[] = { 1, 10, 1, 0, 1, 0, 0, 16 + 8 };
+    append_graph(path, inside_block, sizeof(inside_block) / sizeof(inside_block[0]));
+    CHECK(tr_project_load(path) == NULL);
+
+    // an effect count that wraps num_effects * 5 + num_links around to 0
+    uint64_t wrapping[] = { 1, 10, 1, 0, 1, 0x3333333333333333ULL, 1, 16 };
+    append_graph(path, wrapping, sizeof(wrapping) / sizeof(wrapping[0]));
+    CHECK(tr_project_load(path) == NULL);
+
+    // more samples than the whole file could hold
+    uint64_t too_long[] = { 1, (uint64_t)1 << 62, 1, 0, 1, 0, 0, 16 };
+    append_graph(path, too_long, sizeof(too_long) / sizeof(too_long[0]));
+    CHECK(tr_project_load(path) == NULL);
+
+    // a mono root linking on to a stereo node would overrun tr_read's flat buffer
+    uint64_t mixed_channels[] = { 2, 10, 1, 0, 1, 0, 1, 16, 1, 5, 2, 0, 1, 0, 0, 16 };
+    append_graph(path, mixed_channels, sizeof(mixed_channels) / sizeof(mixed_channels[0]));
+    CHECK(tr_project_load(path) == NULL);
+
+    // cycles would have reads recursing forever: the root linking to itself, and a longer loop back to it
+    uint64_t self_link[] = { 1, 10, 1, 0, 1, 0, 1, 16, 0 };
+    append_graph(path, self_link, sizeof(self_link) / sizeof(self_link[0]));
+    CHECK(tr_project_load(path) == NULL);
+
+    uint64_t loop[] = { 2, 10, 1, 0, 1, 0, 1, 16, 1, 10, 1, 0, 1, 0, 1, 16, 0 };
+    append_graph(path, loop, sizeof(loop) / sizeof(loop[0]));
+    CHECK(tr_project_load(path) == NULL);
+
+    // two links to the same node is sharing, not a cycle
+    uint64_t shared[] = { 2, 10, 1, 0, 1, 0, 2, 16, 1, 1, 10, 1, 0, 1, 0, 0, 16 };
+    append_graph(path, shared, sizeof(shared) / sizeof(shared[0]));
+    struct sound_seg* root = tr_project_load(path);
+    CHECK(root != NULL);
+    tr_project_destroy(root);
+
+    // a root linking on to a second node: tr_project_destroy has to free both (ASan would notice)
+    uint64_t linked[] = { 2, 10, 1, 0, 1, 0, 1, 16, 1, 10, 1, 0, 1, 0, 0, 16 };
+    append_graph(path, linked, sizeof(linked) / sizeof(linked[0]));
+    root = tr_project_load(path);
+    CHECK(root != NULL);
+    if (root) CHECK_TRACK(root, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9);
+    tr_project_destroy(root);
+
+    remove(path);
+}
+
+// ---------------- stats (user-031) ----------------
+
+#ifdef TR_STATS
+
+static uint64_t hist_total(const struct tr_op_stats* op) {
+    uint64_t total = 0;
+    for (size_t b = 0; b < TR_STATS_BUCKETS; b++) total += op->latency_hist[b];
+    return total;
+}
+
+static void test_stats(void) {
+    struct tr_stats st;
+    int16_t buf[100];
+    fill_noise(buf, 100, 31);
+
+    tr_stats_reset();
+    struct sound_seg* seg = tr_init();
+    tr_write(seg, buf, 0, 100); // grows past the initial 8 frames: one realloc
+    tr_read(seg, buf, 0, 10);
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_WRITE].calls == 1 && st.ops[TR_OP_WRITE].allocs == 1 && st.ops[TR_OP_WRITE].bytes_copied == 200);
+    CHECK(st.ops[TR_OP_READ].calls == 1 && st.ops[TR_OP_READ].allocs == 0 && st.ops[TR_OP_READ].bytes_copied == 20);
+    CHECK(hist_total(&st.ops[TR_OP_WRITE]) == 1);
+
+    // 90 frames move up; then 30 do and the buffer shrinks under half full
+    CHECK(tr_delete_range(seg, 0, 10));
+    CHECK(tr_delete_range(seg, 0, 60));
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_DELETE_RANGE].calls == 2 && st.ops[TR_OP_DELETE_RANGE].bytes_copied == 240);
+    CHECK(st.ops[TR_OP_DELETE_RANGE].allocs == 1);
+    tr_destroy(seg);
+
+    // a pending reverse gets baked before the write: its effect list and its pass over the 50 reversed
+    // frames are charged to the write
+    seg = tr_init();
+    tr_write(seg, buf, 0, 100);
+    tr_add_effect(seg, TR_EFFECT_REVERSE, 0, 50, 0, 0);
+    tr_stats_reset();
+    tr_write(seg, buf, 0, 10);
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_WRITE].calls == 1 && st.ops[TR_OP_WRITE].allocs == 1);
+    CHECK(st.ops[TR_OP_WRITE].bytes_copied == (50 + 10) * sizeof(int16_t));
+
+    // same for a delete: 20 reversed frames, then the 90 after the cut move up
+    tr_add_effect(seg, TR_EFFECT_REVERSE, 0, 20, 0, 0);
+    CHECK(tr_delete_range(seg, 0, 10));
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_DELETE_RANGE].calls == 1 && st.ops[TR_OP_DELETE_RANGE].allocs == 1);
+    CHECK(st.ops[TR_OP_DELETE_RANGE].bytes_copied == (20 + 90) * sizeof(int16_t));
+    tr_destroy(seg);
+
+    // a stereo target gets down-mixed (two buffers), the mono ad is used in place, the match list grows once
+    tr_stats_reset();
+    int16_t frames[40] = {0};
+    int16_t ad_data[3] = { 300, -300, 300 };
+    for (size_t c = 0; c < 2; c++) {
+        frames[10 + c] = 300;
+        frames[12 + c] = -300;
+        frames[14 + c] = 300;
+    }
+    struct sound_seg* target = tr_init_channels(2, TR_LAYOUT_INTERLEAVED);
+    tr_write(target, frames, 0, 20);
+    struct sound_seg* ad = track_of(ad_data, 3);
+
+    size_t count = 0;
+    free(tr_identify_matches_alloc(target, ad, NULL, &count));
+    CHECK(count == 1);
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_IDENTIFY].calls == 1 && st.ops[TR_OP_IDENTIFY].allocs == 3);
+    CHECK(st.ops[TR_OP_IDENTIFY].bytes_copied == 20 * 2 * sizeof(int16_t));
+
+    // bailing out early (ad longer than the target) is still a timed call, with nothing allocated
+    free(tr_identify_matches_alloc(ad, target, NULL, &count));
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_IDENTIFY].calls == 2 && st.ops[TR_OP_IDENTIFY].allocs == 3);
+    CHECK(hist_total(&st.ops[TR_OP_IDENTIFY]) == 2);
+
+    tr_stats_reset();
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_IDENTIFY].calls == 0 && st.ops[TR_OP_WRITE].bytes_copied == 0 && st.max_chain_depth == 0);
+
+    tr_destroy(target);
+    tr_destroy(ad);
+}
+
+#else
+
+// without -DTR_STATS nothing is collected and tr_stats_get hands back zeros
+static void test_stats(void) {
+    struct sound_seg* seg = ramp_track(10);
+    struct tr_stats st;
+    memset(&st, 0xff, sizeof(st));
+    tr_stats_get(&st);
+    CHECK(st.ops[TR_OP_WRITE].calls == 0 && st.max_chain_depth == 0);
+    tr_destroy(seg);
+}
+
+#endif
+
+// ---------------- multi-channel (user-032) ----------------
+
+// random growing writes, deletes (which shrink the buffer) and layout flips against a plain interleaved model
+static void test_planar_resize_delete(void) {
+    srand(32);
+    for (uint16_t channels = 1; channels <= 3; channels++) {
+        struct sound_seg* seg = tr_init_channels(channels, TR_LAYOUT_PLANAR);
+        int16_t* model = malloc(4096 * channels * sizeof(int16_t));
+        int16_t* got = malloc(4096 * channels * sizeof(int16_t));
+        int16_t chunk[300 * 3];
+        size_t len = 0;
+
+        for (int round = 0; round < 300; round++) {
+            int op = rand() % 5;
+            if (op <= 1 || len < 10) {
+                // append or overwrite, often past the end so the planes have to move to a new stride
+                size_t pos = len > 0 ? (size_t)rand() % (len + 1) : 0;
+                size_t span = 1 + (size_t)rand() % 300;
+                if (pos + span > 4096) continue;
+                fill_noise(chunk, span * channels, (unsigned)round);
+                tr_write(seg, chunk, pos, span);
+                memcpy(model + pos * channels, chunk, span * channels * sizeof(int16_t));
+                if (pos + span > len) len = pos + span;
+            } else if (op <= 3) {
+                // big deletes drop the buffer under half full and pull the planes in
+                size_t pos = (size_t)rand() % len;
+                size_t cut = 1 + (size_t)rand() % (len - pos);
+                CHECK(tr_delete_range(seg, pos, cut));
+                memmove(model + pos * channels, model + (pos + cut) * channels, (len - pos - cut) * channels * sizeof(int16_t));
+                len -= cut;
+            } else {
+                enum tr_layout layout = tr_get_layout(seg) == TR_LAYOUT_PLANAR ? TR_LAYOUT_INTERLEAVED : TR_LAYOUT_PLANAR;
+                CHECK(tr_set_layout(seg, layout));
+            }
+
+            CHECK(tr_length(seg) == len);
+            tr_read(seg, got, 0, len);
+            CHECK(memcmp(got, model, len * channels * sizeof(int16_t)) == 0);
+
+            if (tr_get_layout(seg) == TR_LAYOUT_PLANAR) {
+                for (uint16_t c = 0; c < channels; c++) {
+                    const int16_t* plane = tr_channel_data(seg, c);
+                    bool same = plane != NULL;
+                    for (size_t f = 0; same && f < len; f++) same = plane[f] == model[f * channels + c];
+                    CHECK(same);
+                }
+            }
+        }
+
+        free(got);
+        free(model);
+        tr_destroy(seg);
+    }
+}
+
+// a project as the first version of the format wrote it: mono nodes of length, blocks, effects, links
+static void write_v1_project(const char* path, const int16_t* samples, uint64_t len) {
+    FILE* f = fopen(path, "wb");
+    uint32_t version = 1;
+    uint64_t reserved = 0;
+    fwrite("TRPJ", 1, 4, f);
+    fwrite(&version, sizeof(version), 1, f);
+    fwrite(&reserved, sizeof(reserved), 1, f);
+
+    uint32_t record_reserved = 0;
+    size_t pad_len = (8 - (len * sizeof(int16_t)) % 8) % 8;
+    uint64_t payload = 16 + len * sizeof(int16_t) + pad_len;
+    uint64_t head[2] = { 0, len }; // the hash only matters for dedup
+    fwrite("BLK", 1, 4, f);
+    fwrite(&record_reserved, sizeof(record_reserved), 1, f);
+    fwrite(&payload, sizeof(payload), 1, f);
+    fwrite(head, sizeof(head), 1, f);
+    fwrite(samples, sizeof(int16_t), len, f);
+    fwrite(&reserved, 1, pad_len, f);
+    fclose(f);
+
+    uint64_t graph[] = { 1, len, 1, 0, 0, 16 };
+    append_graph(path, graph, sizeof(graph) / sizeof(graph[0]));
+}
+
+static uint32_t project_file_version(const char* path) {
+    uint32_t version = 0;
+    FILE* f = fopen(path, "rb");
+    fseek(f, 4, SEEK_SET);
+    if (fread(&version, sizeof(version), 1, f) != 1) version = 0;
+    fclose(f);
+    return version;
+}
+
+static void test_project_v1(void) {
+    char path[256];
+    scratch_path(path, sizeof(path), "v1.trp");
+
+    int16_t samples[10] = { 5, 4, 3, 2, 1, 0, -1, -2, -3, -4 };
+    write_v1_project(path, samples, 10);
+
+    struct sound_seg* loaded = tr_project_load(path);
+    CHECK(loaded != NULL && tr_channels(loaded) == 1 && tr_get_layout(loaded) == TR_LAYOUT_INTERLEAVED);
+    if (loaded) CHECK_TRACK(loaded, 5, 4, 3, 2, 1, 0, -1, -2, -3, -4);
+
+    // mono saves append to it and it stays a version 1 file
+    if (loaded) {
+        CHECK(tr_delete_range(loaded, 0, 2));
+        CHECK(tr_project_save(path, loaded));
+        CHECK(project_file_version(path) == 1);
+        struct sound_seg* again = tr_project_load(path);
+        CHECK(again != NULL);
+        if (again) CHECK_TRACK(again, 3, 2, 1, 0, -1, -2, -3, -4);
+        tr_project_destroy(again);
+    }
+    tr_project_destroy(loaded);
+
+    // a stereo segment can't be written as a version 1 node, and the file is left as it was
+    struct sound_seg* stereo = tr_init_channels(2, TR_LAYOUT_INTERLEAVED);
+    tr_write(stereo, samples, 0, 5);
+    CHECK(!tr_project_save(path, stereo));
+    loaded = tr_project_load(path);
+    CHECK(loaded != NULL && tr_channels(loaded) == 1 && tr_length(loaded) == 8);
+    tr_project_destroy(loaded);
+    tr_destroy(stereo);
+
+    remove(path);
+}
+
+int main(void) {
+    if (mkdtemp(scratch_dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_effect_order();
+    test_effect_fade_and_clamp();
+    test_effect_fade_cut();
+    test_effect_edits_after_reverse();
+    test_effect_delete_model();
+    test_identify_sees_effects();
+    test_identify_top_k();
+    test_identify_overlap();
+    test_batch_load();
+    test_project_round_trip();
+    test_project_torn_tail();
+    test_project_incremental();
+    test_project_copied_file();
+    test_project_load_hardening();
+    test_stats();
+    test_planar_resize_delete();
+    test_project_v1();
+
+    rmdir(scratch_dir);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
+
+
+// older manual checks from before the struct went opaque, kept for reference
+
 // #include <stdio.h>
 // #include <stdint.h>
 // #include <stdlib.h>